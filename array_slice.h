@@ -0,0 +1,182 @@
+/*
+* array_slice - owning view of a range of a strong_array.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* An array_slice shares the counter block of the strong_array it was cut
+* from and adds an offset and a length, so a sub-range keeps the whole
+* buffer alive without knowing about the rest of it. Cutting a slice costs
+* one count increment and no allocation; moving one (C++11) costs nothing,
+* which is how disjoint slices are handed to worker threads. For that the
+* counter defaults to the interlocked mt_ref_count.
+*
+* strong_array does not know its own length, it has to be given once when
+* the first slice is made; make_array_slice allocates and does both.
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __ARRAY_SLICE_H__
+#define __ARRAY_SLICE_H__
+
+#include <stddef.h>
+#include "smart_ptr.h"
+
+namespace smart_ptr {
+
+template <class T, typename mem_mgr=array_mem_mgr<T>, typename ref_counter=mt_ref_count>
+class array_slice
+{
+public:
+    typedef strong_array<T, mem_mgr, ref_counter> array_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    array_slice() : m_offset(0), m_length(0)
+    {
+    }
+
+    // the first length elements of a
+    array_slice(const array_type &a, size_t length)
+        : m_array(a), m_offset(0), m_length(a.get() ? length : 0)
+    {
+    }
+
+    array_slice(const array_type &a, size_t offset, size_t length)
+        : m_array(a), m_offset(offset), m_length(a.get() ? length : 0)
+    {
+    }
+
+    array_slice(const array_slice &rhs)
+        : m_array(rhs.m_array), m_offset(rhs.m_offset), m_length(rhs.m_length)
+    {
+    }
+
+#if SMART_PTR_HAS_RVALUE_REFS
+    // hands the reference over, the count is not touched
+    array_slice(array_slice &&rhs) : m_offset(rhs.m_offset), m_length(rhs.m_length)
+    {
+        take(rhs);
+    }
+
+    array_slice& operator=(array_slice &&rhs)
+    {
+        if (this != &rhs) {
+            m_offset = rhs.m_offset;
+            m_length = rhs.m_length;
+            take(rhs);
+        }
+        return *this;
+    }
+#endif  // SMART_PTR_HAS_RVALUE_REFS
+
+    array_slice& operator=(const array_slice &rhs)
+    {
+        m_array = rhs.m_array;
+        m_offset = rhs.m_offset;
+        m_length = rhs.m_length;
+        return *this;
+    }
+
+    T* data()       const   { return m_array.get() ? m_array.get() + m_offset : 0; }
+    size_t size()   const   { return m_length; }
+    bool empty()    const   { return m_length == 0; }
+    size_t offset() const   { return m_offset; }
+
+    T& operator[](size_t i) const   { return data()[i]; }
+
+    iterator begin()    const   { return data(); }
+    iterator end()      const   { return data() + m_length; }
+
+    // the array this slice keeps alive
+    const array_type & array() const
+    {
+        return m_array;
+    }
+
+    int use_count() const
+    {
+        return m_array.use_count();
+    }
+
+    // elements [offset, offset + length) of this slice, clamped to it
+    array_slice subslice(size_t offset, size_t length) const
+    {
+        if (offset > m_length) {
+            offset = m_length;
+        }
+        if (length > m_length - offset) {
+            length = m_length - offset;
+        }
+        return array_slice(m_array, m_offset + offset, length);
+    }
+
+    // left gets [0, at), right gets [at, size()); either may be this slice
+    void split(size_t at, array_slice &left, array_slice &right) const
+    {
+        array_slice keep(*this);
+        left = keep.subslice(0, at);
+        right = keep.subslice(at, keep.m_length);
+    }
+
+    // cut the first n elements off this slice and return them
+    array_slice take_front(size_t n)
+    {
+        array_slice front = subslice(0, n);
+        m_offset += front.m_length;
+        m_length -= front.m_length;
+        return front;
+    }
+
+    void reset()
+    {
+        m_array.reset();
+        m_offset = 0;
+        m_length = 0;
+    }
+
+private:
+    void take(array_slice &rhs)
+    {
+        ref_counter *counter;
+        T *p = rhs.m_array.detach(counter);
+        m_array.attach(p, counter);
+        rhs.m_offset = 0;
+        rhs.m_length = 0;
+    }
+
+    array_type m_array;
+    size_t m_offset;
+    size_t m_length;
+};
+
+
+template <typename T, typename mem_mgr=array_mem_mgr<T>, typename ref_counter=mt_ref_count>
+class make_array_slice
+{
+public:
+    typedef array_slice<T, mem_mgr, ref_counter> slice_type;
+
+    // a new array of n elements, as one slice
+    static slice_type generate(size_t n)
+    {
+        return slice_type(typename slice_type::array_type(mem_mgr::allocate((int)n)), n);
+    }
+};
+
+}; // namespace smart_ptr
+
+
+#endif // __ARRAY_SLICE_H__
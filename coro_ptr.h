@@ -0,0 +1,201 @@
+/*
+* coro_ptr - coroutine tasks that own their object through one strong_ptr.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* A coroutine that keeps a Session alive across suspensions usually copies
+* its strong_ptr into every awaiter and every callback it hands out, two
+* count updates per co_await plus a pointer copy in the frame. An
+* owned_task is a detached coroutine whose first parameter, a strong_ptr
+* taken by value, is its single owner: the promise finds it there, and
+* because it lives as long as the frame, everything the coroutine starts
+* can borrow the object with a strong_ref instead of copying the pointer:
+*
+*     owned_task<Session> serve(SessionPtr s, event_loop &loop)
+*     {
+*         for (;;) {
+*             co_await await_callback([&](auto resume) {
+*                 loop.read(strong_ref<Session>(s), resume);
+*             });
+*             ...
+*         }
+*     }
+*
+* await_callback(f) suspends and calls f with a resumer, a one pointer
+* callable that continues the task; resume.owner() is there to borrow from.
+* await_callback_weak(f) is the same for waits that should not keep the
+* object alive: the task lets go of its owner while suspended and f gets a
+* weak_resumer, which holds a weak_ptr instead and destroys the frame
+* rather than resuming it if the object went away in the meantime -
+* dropping the other owners cancels the task at its next wake-up. Do not
+* hold strong_refs across a weak wait. The task starts right away and
+* frees its frame when it finishes. The promise adds one pointer to the
+* frame, the awaiter a reference to f.
+*
+* Requires C++20 coroutines.
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __CORO_PTR_H__
+#define __CORO_PTR_H__
+
+#include <stddef.h>
+#include <coroutine>
+#include <exception>
+#include "smart_ptr.h"
+
+namespace smart_ptr {
+
+// Tasks are usually resumed on another thread, so the counter defaults to
+// the interlocked one.
+template <class T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=mt_ref_count>
+class owned_task
+{
+public:
+    typedef strong_ptr<T, mem_mgr, ref_counter> pointer_type;
+    typedef weak_ptr<T, mem_mgr, ref_counter> weak_type;
+
+    class promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    // continues a suspended task; call it exactly once
+    class resumer
+    {
+    public:
+        explicit resumer(handle_type h) : m_handle(h)
+        {
+        }
+
+        void operator()() const
+        {
+            m_handle.resume();
+        }
+
+        // the task's owner, to borrow from while the task waits
+        const pointer_type & owner() const
+        {
+            return m_handle.promise().owner();
+        }
+
+    private:
+        handle_type m_handle;
+    };
+
+    // the resumer of a weak wait: it holds the only reference the task
+    // keeps, a weak one, and destroys the task if the object went away
+    class weak_resumer
+    {
+    public:
+        explicit weak_resumer(handle_type h) : m_handle(h), m_object(h.promise().owner())
+        {
+        }
+
+        void operator()() const
+        {
+            pointer_type &owner = m_handle.promise().owner();
+            owner = m_object.lock();
+            if (owner.get()) {
+                m_handle.resume();
+            } else {
+                m_handle.destroy();
+            }
+        }
+
+    private:
+        handle_type m_handle;
+        weak_type m_object;
+    };
+
+    class promise_type
+    {
+    public:
+        typedef typename owned_task::resumer resumer;
+        typedef typename owned_task::weak_resumer weak_resumer;
+
+        // the first parameter of the coroutine is its owner
+        template <class... Args>
+        promise_type(pointer_type &owner, Args &...) : m_owner(&owner)
+        {
+        }
+
+        owned_task get_return_object()              { return owned_task(); }
+        std::suspend_never initial_suspend()        { return std::suspend_never(); }
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+        void return_void()                          {}
+        void unhandled_exception()                  { std::terminate(); }
+
+        // the owner, in the frame for as long as the frame lives
+        pointer_type & owner() const
+        {
+            return *m_owner;
+        }
+
+    private:
+        pointer_type *m_owner;
+    };
+};
+
+// suspends the task and hands f a resumer, see await_callback(). f is a
+// temporary of the co_await expression and lives until it completes.
+template <typename callback_fn, bool weak>
+class callback_awaiter
+{
+public:
+    explicit callback_awaiter(const callback_fn &f) : m_fn(f)
+    {
+    }
+
+    bool await_ready() const    { return false; }
+    void await_resume() const   {}
+
+    template <class promise>
+    void await_suspend(std::coroutine_handle<promise> h)
+    {
+        // f may resume and finish the task right here, taking the
+        // temporary with the frame, so it runs from a copy
+        callback_fn f(m_fn);
+        if constexpr (weak) {
+            typename promise::weak_resumer resume(h);
+            h.promise().owner().reset();
+            f(resume);
+        } else {
+            f(typename promise::resumer(h));
+        }
+    }
+
+private:
+    const callback_fn &m_fn;
+};
+
+// co_await await_callback([&](auto resume) { start_operation(..., resume); });
+template <typename callback_fn>
+callback_awaiter<callback_fn, false> await_callback(const callback_fn &f)
+{
+    return callback_awaiter<callback_fn, false>(f);
+}
+
+// the same, without keeping the owned object alive while waiting; the
+// task is destroyed instead of resumed if it went away
+template <typename callback_fn>
+callback_awaiter<callback_fn, true> await_callback_weak(const callback_fn &f)
+{
+    return callback_awaiter<callback_fn, true>(f);
+}
+
+}; // namespace smart_ptr
+
+
+#endif // __CORO_PTR_H__
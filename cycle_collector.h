@@ -0,0 +1,532 @@
+/*
+* cycle_collector - opt-in trial-deletion collector for strong_ptr cycles.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* A type takes part by specializing cycle_edges<T> to report its strong_ptr
+* members, and its objects by being tracked (make_collectable_ptr does both
+* the allocation and the tracking). Each step() takes a bounded slice of
+* tracked objects, counts the references they hold on each other and keeps
+* everything reachable from an object that has more owners than that.
+* What is left is only owned from inside the slice, i.e. a dead cycle: its
+* members are pinned, their edges into the cycle are reset and the pins are
+* dropped, so the objects die through the ordinary base_ptr::release and
+* mem_mgr::deallocate path. A slice cut short by the budget is still safe,
+* references from outside the slice just count as external.
+*
+* The collector reads the strong_ptr members of live objects. Threads that
+* reassign those members while a collector may run must hold a
+* cycle_collector::mutator_lock. A weak_ptr::lock racing with the collector
+* may revive an object of a dead cycle whose members were already reset.
+*
+* Requires C++14 (std::shared_timed_mutex) and a thread-safe counter when
+* the background thread is used.
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __CYCLE_COLLECTOR_H__
+#define __CYCLE_COLLECTOR_H__
+
+#include <stddef.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "smart_ptr.h"
+
+namespace smart_ptr {
+
+// Specialize for every collectable type:
+//
+//     template <> struct cycle_edges<Node> {
+//         template <class V> static void visit(Node &n, V &v) { v(n.next); v(n.parent); }
+//     };
+template <class T> struct cycle_edges;
+
+
+template <typename ref_counter=mt_ref_count>
+class cycle_collector
+{
+public:
+    typedef std::shared_lock<std::shared_timed_mutex> mutator_lock;
+
+    struct statistics
+    {
+        size_t steps;
+        size_t tracked;             // objects currently in the registry
+        size_t reclaimed_objects;
+        size_t reclaimed_bytes;     // object sizes plus their counter blocks
+        size_t truncated_steps;     // steps whose slice hit the budget
+        double total_pause_ms;
+        double max_pause_ms;
+    };
+
+    cycle_collector() : m_cursor(0), m_wrapped(false), m_running(false)
+    {
+        m_stats = statistics();
+    }
+
+    ~cycle_collector()
+    {
+        stop();
+        std::lock_guard<std::mutex> guard(m_registry_lock);
+        for (size_t i = 0; i < m_nodes.size(); ++i) {
+            m_nodes[i].forget(m_nodes[i].object, m_nodes[i].counter);
+        }
+    }
+
+    // hold while reassigning strong_ptr members of tracked objects
+    mutator_lock lock_mutator()
+    {
+        return mutator_lock(m_world_lock);
+    }
+
+    // start watching an object, the registry keeps only a weak reference;
+    // immortal objects are never freed and not watched
+    template <class T, typename mem_mgr>
+    void track(const strong_ptr<T, mem_mgr, ref_counter> &p)
+    {
+        if (!p.get() || p.immortal()) {
+            return;
+        }
+        weak_ptr<T, mem_mgr, ref_counter> wp(p);
+        node_info info;
+        info.object = const_cast<void *>(static_cast<const void *>(p.get()));
+        info.size = sizeof(T) + sizeof(ref_counter);
+        info.visit = &visit_node<T>;
+        info.release = &release_node<T, mem_mgr>;
+        info.forget = &forget_node<T, mem_mgr>;
+        wp.detach(info.counter);
+
+        std::lock_guard<std::mutex> guard(m_registry_lock);
+        if (m_index.find(info.counter) != m_index.end()) {
+            info.forget(info.object, info.counter);
+            return;
+        }
+        m_index[info.counter] = m_nodes.size();
+        m_nodes.push_back(info);
+    }
+
+    // examine at most budget objects, return the number reclaimed
+    size_t step(size_t budget=4096)
+    {
+        std::vector<node_info> live;
+        std::vector<node_info> garbage;
+        bool truncated = false;
+        double ms = 0;
+        {
+            // the pause is the time the mutators are locked out
+            std::unique_lock<std::shared_timed_mutex> world(m_world_lock);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> guard(m_registry_lock);
+            truncated = scan(budget, live, garbage);
+            ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // nobody else can reach a dead cycle, so this needs no lock; the pins
+        // keep every member alive until all edges into the cycle are reset
+        size_t bytes = 0;
+        edge_visitor clear(this, edge_visitor::clear_edges);
+        for (size_t i = 0; i < garbage.size(); ++i) {
+            clear.add_member(garbage[i].counter);
+        }
+        for (size_t i = 0; i < garbage.size(); ++i) {
+            garbage[i].visit(garbage[i].object, clear);
+        }
+        for (size_t i = 0; i < garbage.size(); ++i) {
+            bytes += garbage[i].size;
+            garbage[i].release(garbage[i].object, garbage[i].counter);
+            garbage[i].forget(garbage[i].object, garbage[i].counter);
+        }
+        for (size_t i = 0; i < live.size(); ++i) {
+            live[i].release(live[i].object, live[i].counter);
+        }
+
+        std::lock_guard<std::mutex> guard(m_registry_lock);
+        m_stats.steps++;
+        m_stats.reclaimed_objects += garbage.size();
+        m_stats.reclaimed_bytes += bytes;
+        m_stats.truncated_steps += truncated ? 1 : 0;
+        m_stats.total_pause_ms += ms;
+        if (ms > m_stats.max_pause_ms) {
+            m_stats.max_pause_ms = ms;
+        }
+        return garbage.size();
+    }
+
+    // run steps until every tracked object was examined once
+    size_t collect(size_t budget=4096)
+    {
+        size_t nRs = 0;
+        {
+            std::lock_guard<std::mutex> guard(m_registry_lock);
+            m_cursor = m_nodes.size();
+            m_wrapped = false;
+        }
+        for (;;) {
+            nRs += step(budget);
+            std::lock_guard<std::mutex> guard(m_registry_lock);
+            if (m_wrapped || m_cursor == 0) {
+                break;
+            }
+        }
+        return nRs;
+    }
+
+    // run one step every interval on a background thread
+    void start(std::chrono::milliseconds interval, size_t budget=4096)
+    {
+        std::lock_guard<std::mutex> guard(m_thread_lock);
+        if (m_running) {
+            return;
+        }
+        m_running = true;
+        m_thread = std::thread([this, interval, budget]() {
+            std::unique_lock<std::mutex> lock(m_thread_lock);
+            while (m_running) {
+                lock.unlock();
+                step(budget);
+                lock.lock();
+                m_wakeup.wait_for(lock, interval, [this]() { return !m_running; });
+            }
+        });
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_thread_lock);
+            if (!m_running) {
+                return;
+            }
+            m_running = false;
+        }
+        m_wakeup.notify_all();
+        m_thread.join();
+    }
+
+    statistics get_statistics() const
+    {
+        std::lock_guard<std::mutex> guard(m_registry_lock);
+        statistics st = m_stats;
+        st.tracked = m_nodes.size();
+        return st;
+    }
+
+    // collector used by make_collectable_ptr
+    static cycle_collector & instance()
+    {
+        static cycle_collector collector;
+        return collector;
+    }
+
+private:
+    class edge_visitor;
+
+    struct node_info
+    {
+        void *object;
+        ref_counter *counter;
+        size_t size;
+        void (*visit)(void *object, edge_visitor &v);
+        void (*release)(void *object, ref_counter *counter);    // drop one strong reference
+        void (*forget)(void *object, ref_counter *counter);     // drop the registry's weak reference
+    };
+
+    // walks the strong_ptr members reported by cycle_edges<T>
+    class edge_visitor
+    {
+    public:
+        enum mode { discover, count_internal, mark_live, clear_edges };
+
+        edge_visitor(cycle_collector *owner, mode m) : m_owner(owner), m_mode(m), m_budget(0), m_truncated(false)
+        {
+        }
+
+        template <class U, typename mem_mgr>
+        void operator()(base_ptr<U, true, mem_mgr, ref_counter> &p)
+        {
+            ref_counter *counter = p.get_counter();
+            if (!counter || is_immortal(counter)) {
+                return;     // immortal edges can never be part of a collectable cycle
+            }
+            if (m_mode == clear_edges) {
+                if (m_local.find(counter) != m_local.end()) {
+                    p.reset();
+                }
+                return;
+            }
+            typename local_map::iterator it = m_local.find(counter);
+            if (m_mode == discover) {
+                if (it != m_local.end()) {
+                    return;
+                }
+                typename index_map::const_iterator reg = m_owner->m_index.find(counter);
+                if (reg == m_owner->m_index.end()) {
+                    return;     // not tracked, cannot be part of a collectable cycle
+                }
+                if (m_slice.size() >= m_budget) {
+                    m_truncated = true;
+                    return;
+                }
+                add(reg->second);
+            } else if (it != m_local.end()) {
+                slot &s = m_slots[it->second];
+                if (m_mode == count_internal) {
+                    s.internal++;
+                } else if (!s.live) {
+                    s.live = true;
+                    m_pending.push_back(it->second);
+                }
+            }
+        }
+
+        // pin and add an object to the slice, false if it is already dead
+        bool add(size_t registry_index)
+        {
+            ref_counter *counter = m_owner->m_nodes[registry_index].counter;
+            if (!counter->inc_ref_if_alive()) {
+                return false;
+            }
+            m_local[counter] = m_slice.size();
+            m_slice.push_back(registry_index);
+            slot s = { 0, false };
+            m_slots.push_back(s);
+            return true;
+        }
+
+        void add_member(ref_counter *counter)
+        {
+            m_local[counter] = 0;
+        }
+
+        struct slot
+        {
+            int internal;
+            bool live;
+        };
+        typedef std::unordered_map<const ref_counter *, size_t> local_map;
+
+        cycle_collector *m_owner;
+        mode m_mode;
+        size_t m_budget;
+        bool m_truncated;
+        local_map m_local;
+        std::vector<size_t> m_slice;
+        std::vector<slot> m_slots;
+        std::vector<size_t> m_pending;
+    };
+
+    typedef std::unordered_map<const ref_counter *, size_t> index_map;
+
+    template <class T>
+    static void visit_node(void *object, edge_visitor &v)
+    {
+        cycle_edges<T>::visit(*static_cast<T *>(object), v);
+    }
+
+    template <class T, typename mem_mgr>
+    static void release_node(void *object, ref_counter *counter)
+    {
+        strong_ptr<T, mem_mgr, ref_counter> sp;
+        sp.attach(static_cast<T *>(object), counter);
+    }
+
+    template <class T, typename mem_mgr>
+    static void forget_node(void *object, ref_counter *counter)
+    {
+        weak_ptr<T, mem_mgr, ref_counter> wp;
+        wp.attach(static_cast<T *>(object), counter);
+    }
+
+    // Pick the next slice and split it, pinned, into live objects and dead
+    // cycles. Roots are taken walking down from the cursor: a swap-remove
+    // only ever moves an already visited entry, so none is skipped in a pass.
+    bool scan(size_t budget, std::vector<node_info> &live, std::vector<node_info> &garbage)
+    {
+        edge_visitor v(this, edge_visitor::discover);
+        v.m_budget = budget ? budget : 1;
+
+        std::vector<size_t> expired;
+        size_t visited = 0;
+        while (v.m_slice.size() < v.m_budget && visited < m_nodes.size()) {
+            if (m_cursor == 0) {
+                m_cursor = m_nodes.size();
+                m_wrapped = true;
+            }
+            --m_cursor;
+            ++visited;
+            if (v.m_local.find(m_nodes[m_cursor].counter) != v.m_local.end()) {
+                continue;
+            }
+            size_t first = v.m_slice.size();
+            if (!v.add(m_cursor)) {
+                expired.push_back(m_cursor);
+                continue;
+            }
+            for (size_t i = first; i < v.m_slice.size(); ++i) {
+                node_info &n = m_nodes[v.m_slice[i]];
+                n.visit(n.object, v);
+            }
+        }
+
+        v.m_mode = edge_visitor::count_internal;
+        for (size_t i = 0; i < v.m_slice.size(); ++i) {
+            node_info &n = m_nodes[v.m_slice[i]];
+            n.visit(n.object, v);
+        }
+
+        // anything owned from outside the slice is live, and so is all it
+        // reaches; one of the owners is our own pin
+        v.m_mode = edge_visitor::mark_live;
+        for (size_t i = 0; i < v.m_slice.size(); ++i) {
+            if (m_nodes[v.m_slice[i]].counter->get_ref_count() - 1 > v.m_slots[i].internal) {
+                v.m_slots[i].live = true;
+                v.m_pending.push_back(i);
+            }
+        }
+        while (!v.m_pending.empty()) {
+            size_t i = v.m_pending.back();
+            v.m_pending.pop_back();
+            node_info &n = m_nodes[v.m_slice[i]];
+            n.visit(n.object, v);
+        }
+
+        std::vector<size_t> removed(expired);
+        for (size_t i = 0; i < v.m_slice.size(); ++i) {
+            if (v.m_slots[i].live) {
+                live.push_back(m_nodes[v.m_slice[i]]);
+            } else {
+                garbage.push_back(m_nodes[v.m_slice[i]]);
+                removed.push_back(v.m_slice[i]);
+            }
+        }
+
+        // highest index first, so a swap-remove never moves a pending entry
+        std::sort(removed.begin(), removed.end());
+        for (size_t i = removed.size(); i > 0; --i) {
+            size_t idx = removed[i - 1];
+            bool dead = std::find(expired.begin(), expired.end(), idx) != expired.end();
+            remove_at(idx, dead);
+        }
+        if (m_cursor > m_nodes.size()) {
+            m_cursor = m_nodes.size();
+        }
+        return v.m_truncated;
+    }
+
+    // swap-remove a registry entry, dropping its weak reference if asked
+    void remove_at(size_t i, bool forget)
+    {
+        node_info info = m_nodes[i];
+        m_index.erase(info.counter);
+        if (i + 1 != m_nodes.size()) {
+            m_nodes[i] = m_nodes.back();
+            m_index[m_nodes[i].counter] = i;
+        }
+        m_nodes.pop_back();
+        if (forget) {
+            info.forget(info.object, info.counter);
+        }
+    }
+
+    cycle_collector(const cycle_collector &);
+    cycle_collector & operator=(const cycle_collector &);
+
+    std::shared_timed_mutex m_world_lock;
+    mutable std::mutex m_registry_lock;
+    std::vector<node_info> m_nodes;
+    index_map m_index;
+    size_t m_cursor;
+    bool m_wrapped;
+    statistics m_stats;
+
+    std::mutex m_thread_lock;
+    std::condition_variable m_wakeup;
+    std::thread m_thread;
+    bool m_running;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+//
+//   function make_collectable_ptr group, make_strong_ptr plus tracking
+//
+
+template <typename T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=mt_ref_count>
+class make_collectable_ptr
+{
+public:
+    typedef strong_ptr<T, mem_mgr, ref_counter> pointer_type;
+    typedef cycle_collector<ref_counter> collector_type;
+
+    static pointer_type generate(void)
+    {
+        return track(make_strong_ptr<T, mem_mgr, ref_counter>::generate());
+    }
+
+    template <typename A1>
+    static pointer_type generate(A1 const &a1)
+    {
+        return track(make_strong_ptr<T, mem_mgr, ref_counter>::generate(a1));
+    }
+
+    template <typename A1, typename A2>
+    static pointer_type generate(A1 const &a1, A2 const &a2)
+    {
+        return track(make_strong_ptr<T, mem_mgr, ref_counter>::generate(a1, a2));
+    }
+
+    template <typename A1, typename A2, typename A3>
+    static pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3)
+    {
+        return track(make_strong_ptr<T, mem_mgr, ref_counter>::generate(a1, a2, a3));
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4>
+    static pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4)
+    {
+        return track(make_strong_ptr<T, mem_mgr, ref_counter>::generate(a1, a2, a3, a4));
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4, typename A5>
+    static pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5)
+    {
+        return track(make_strong_ptr<T, mem_mgr, ref_counter>::generate(a1, a2, a3, a4, a5));
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
+    static pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5, A6 const &a6)
+    {
+        return track(make_strong_ptr<T, mem_mgr, ref_counter>::generate(a1, a2, a3, a4, a5, a6));
+    }
+
+private:
+    static pointer_type track(const pointer_type &p)
+    {
+        collector_type::instance().track(p);
+        return p;
+    }
+};
+
+}; // namespace smart_ptr
+
+
+#endif // __CYCLE_COLLECTOR_H__
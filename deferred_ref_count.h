@@ -0,0 +1,514 @@
+/*
+* deferred_ref_count - reference counting with per-thread buffered updates.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* basic_ref_count<deferred_thread_model> (deferred_ref_count) does not
+* touch the shared counter when a strong_ptr is copied or dropped. The
+* +1/-1 goes into a small log owned by the calling thread, keyed by the
+* counter block, where a copy and its release cancel out. The log is
+* applied in one batch when it fills up or the thread calls flush().
+*
+* Applied counts can be too low for a while: thread A may apply the -1 of
+* a pointer it dropped before thread B applies the +1 of the copy it took.
+* So a count reaching 0 only makes the block a candidate. collect() asks
+* every registered thread to stop at its next flush(), applies all logs,
+* and frees the candidates still at 0 - with no update pending anywhere
+* that count is exact. Objects are freed through the mem_mgr recorded when
+* the first strong_ptr was created, by the thread running collect().
+*
+* Threads holding deferred pointers must call flush() now and then, and
+* go_offline() before blocking for long, or collect() waits for them.
+* Weak counts are not deferred. use_count() only sees applied updates.
+* Requires C++11.
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __DEFERRED_REF_COUNT_H__
+#define __DEFERRED_REF_COUNT_H__
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "smart_ptr.h"
+
+namespace smart_ptr {
+
+#ifndef SMART_PTR_DEFERRED_LOG_SIZE
+#define SMART_PTR_DEFERRED_LOG_SIZE 256
+#endif  // SMART_PTR_DEFERRED_LOG_SIZE
+
+class deferred_thread_model;
+template <> class basic_ref_count<deferred_thread_model>;
+
+class deferred_thread_model
+{
+public:
+    typedef basic_ref_count<deferred_thread_model> counter_type;
+
+    struct statistics
+    {
+        unsigned long long flushes;     // logs applied
+        unsigned long long updates;     // updates logged
+        unsigned long long applied;     // counter writes after merging
+        unsigned long long collects;
+        unsigned long long reclaimed;   // objects freed
+    };
+
+    // apply this thread's log; a pending collect() waits for the thread here
+    static void flush();
+
+    // stop the registered threads at their next flush(), apply every log
+    // and free the objects whose count is 0; returns how many were freed,
+    // 0 if another thread is collecting already
+    static size_t collect();
+
+    // the thread will not touch deferred pointers until go_online()
+    static void go_offline();
+    static void go_online();
+
+    static statistics get_statistics();
+
+private:
+    class thread_log;
+
+    struct shared_state
+    {
+        shared_state() : stop_requested(false), generation(0)
+        {
+            stats = statistics();
+        }
+
+        std::mutex lock;                    // threads, stop and generation
+        std::condition_variable changed;
+        std::vector<thread_log *> threads;
+        std::atomic<bool> stop_requested;
+        unsigned long long generation;
+
+        std::mutex collect_lock;            // one collect() at a time
+
+        std::mutex candidate_lock;
+        std::vector<counter_type *> candidates;
+
+        std::mutex stats_lock;
+        statistics stats;
+    };
+
+    static shared_state & state()
+    {
+        static shared_state s;
+        return s;
+    }
+
+    static thread_log & local();
+    static void log(counter_type *c, int delta);
+
+    friend class basic_ref_count<deferred_thread_model>;
+};
+
+typedef basic_ref_count<deferred_thread_model> deferred_ref_count;
+
+
+// Strong counts go through the thread logs, the strong_ptr side never sees
+// them drop to 0; weak counts are immediate. The object is freed by collect().
+template <>
+class basic_ref_count<deferred_thread_model>
+{
+public:
+    basic_ref_count() : m_strong_ref_count(1), m_weak_ref_count(1),
+        m_object(0), m_destroy(0), m_dead(false), m_queued(false)
+#if SMART_PTR_CHECK_BORROWS
+        , m_borrow_count(0)
+#endif  // SMART_PTR_CHECK_BORROWS
+    {
+    }
+
+    ~basic_ref_count()
+    {
+    }
+
+    template <class T, typename mem_mgr>
+    void bind(T *p)
+    {
+        m_object = p;
+        m_destroy = &destroy_object<T, mem_mgr>;
+    }
+
+    // dec_ref() never reports 0, collect() frees the object through bind()'s record
+    template <class T, typename mem_mgr>
+    void destroy(T *)
+    {
+    }
+
+    int inc_ref()
+    {
+        deferred_thread_model::log(this, 1);
+        return 1;
+    }
+
+    // the object stays until a collect() in which no thread runs, so a
+    // reference taken now is seen by the next one
+    bool inc_ref_if_alive()
+    {
+        if (m_dead.load(std::memory_order_acquire)) {
+            return false;
+        }
+        deferred_thread_model::log(this, 1);
+        return true;
+    }
+
+    int inc_weak_ref()
+    {
+        return m_weak_ref_count.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    // never reports 0, the object is freed by collect()
+    int dec_ref()
+    {
+        deferred_thread_model::log(this, -1);
+        return 1;
+    }
+
+    int dec_weak_ref()
+    {
+        return m_weak_ref_count.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+
+    // applied updates only, at least 1 while the object lives
+    int get_ref_count() const
+    {
+        if (m_dead.load(std::memory_order_acquire)) {
+            return 0;
+        }
+        int count = m_strong_ref_count.load(std::memory_order_relaxed);
+        return count > 0 ? count : 1;
+    }
+
+    bool expired() const
+    {
+        return m_dead.load(std::memory_order_acquire);
+    }
+
+    int get_weak_ref_count() const
+    {
+        int nRs = m_weak_ref_count.load(std::memory_order_acquire);
+        if (!expired()) {
+            --nRs;
+        }
+        return nRs;
+    }
+
+#if SMART_PTR_CHECK_BORROWS
+    void inc_borrow()           { m_borrow_count.fetch_add(1, std::memory_order_relaxed); }
+    void dec_borrow()           { m_borrow_count.fetch_sub(1, std::memory_order_relaxed); }
+    int get_borrow_count() const { return m_borrow_count.load(std::memory_order_relaxed); }
+#endif  // SMART_PTR_CHECK_BORROWS
+
+private:
+    template <class T, typename mem_mgr>
+    static void destroy_object(void *p)
+    {
+        mem_mgr::deallocate(static_cast<T *>(p));
+    }
+
+    // add a batch of updates, true if this made the block a new candidate
+    bool apply(int delta)
+    {
+        int count = m_strong_ref_count.fetch_add(delta, std::memory_order_acq_rel) + delta;
+        return count <= 0 && !m_queued.exchange(true, std::memory_order_relaxed);
+    }
+
+    // called by collect() with every thread stopped
+    bool reclaim()
+    {
+        m_queued.store(false, std::memory_order_relaxed);
+        if (m_strong_ref_count.load(std::memory_order_acquire) != 0 || m_dead.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        m_dead.store(true, std::memory_order_release);
+#if SMART_PTR_CHECK_BORROWS
+        if (m_borrow_count.load(std::memory_order_relaxed) != 0) {
+            SMART_PTR_BORROW_VIOLATION();
+        }
+#endif  // SMART_PTR_CHECK_BORROWS
+        if (m_destroy) {
+            m_destroy(m_object);
+        }
+        if (0 == dec_weak_ref()) {
+            delete this;
+        }
+        return true;
+    }
+
+    std::atomic<int> m_strong_ref_count;
+    std::atomic<int> m_weak_ref_count;
+    void *m_object;
+    void (*m_destroy)(void *);
+    std::atomic<bool> m_dead;
+    std::atomic<bool> m_queued;
+#if SMART_PTR_CHECK_BORROWS
+    std::atomic<int> m_borrow_count;
+#endif  // SMART_PTR_CHECK_BORROWS
+
+    friend class deferred_thread_model;
+};
+
+
+// per-thread table of pending updates, merged per counter block
+class deferred_thread_model::thread_log
+{
+public:
+    thread_log() : m_online(true), m_parked_generation(0),
+        m_used(0), m_flushes(0), m_updates(0), m_applied(0)
+    {
+        for (size_t i = 0; i < capacity; ++i) {
+            m_slots[i].counter = 0;
+            m_slots[i].delta = 0;
+        }
+        shared_state &s = state();
+        std::unique_lock<std::mutex> guard(s.lock);
+        // a thread must not start mutating in the middle of a collect
+        s.changed.wait(guard, [&s]() { return !s.stop_requested.load(std::memory_order_relaxed); });
+        s.threads.push_back(this);
+    }
+
+    ~thread_log()
+    {
+        apply();
+        publish_statistics();
+        shared_state &s = state();
+        std::lock_guard<std::mutex> guard(s.lock);
+        for (size_t i = 0; i < s.threads.size(); ++i) {
+            if (s.threads[i] == this) {
+                s.threads[i] = s.threads.back();
+                s.threads.pop_back();
+                break;
+            }
+        }
+        s.changed.notify_all();
+    }
+
+    void add(counter_type *c, int delta)
+    {
+        ++m_updates;
+        size_t i = ((size_t)c >> 4) * 0x9E3779B9u & (capacity - 1);
+        for (;;) {
+            slot &e = m_slots[i];
+            if (e.counter == c) {
+                e.delta += delta;
+                return;
+            }
+            if (!e.counter) {
+                e.counter = c;
+                e.delta = delta;
+                if (++m_used > capacity / 2) {
+                    apply();
+                }
+                return;
+            }
+            i = (i + 1) & (capacity - 1);
+        }
+    }
+
+    // write the merged updates to their counters
+    void apply()
+    {
+        if (!m_used) {
+            return;
+        }
+        std::vector<counter_type *> found;
+        for (size_t i = 0; i < capacity; ++i) {
+            slot &e = m_slots[i];
+            if (!e.counter) {
+                continue;
+            }
+            if (e.delta != 0) {
+                ++m_applied;
+                if (e.counter->apply(e.delta)) {
+                    found.push_back(e.counter);
+                }
+            }
+            e.counter = 0;
+            e.delta = 0;
+        }
+        m_used = 0;
+        ++m_flushes;
+        if (!found.empty()) {
+            shared_state &s = state();
+            std::lock_guard<std::mutex> guard(s.candidate_lock);
+            s.candidates.insert(s.candidates.end(), found.begin(), found.end());
+        }
+        if ((m_flushes & 0x3F) == 0) {
+            publish_statistics();
+        }
+    }
+
+    void publish_statistics()
+    {
+        shared_state &s = state();
+        std::lock_guard<std::mutex> guard(s.stats_lock);
+        s.stats.flushes += m_flushes;
+        s.stats.updates += m_updates;
+        s.stats.applied += m_applied;
+        m_flushes = m_updates = m_applied = 0;
+    }
+
+    // guarded by shared_state::lock
+    bool m_online;
+    unsigned long long m_parked_generation;
+
+private:
+    enum { capacity = SMART_PTR_DEFERRED_LOG_SIZE };
+
+    struct slot
+    {
+        counter_type *counter;
+        int delta;
+    };
+
+    slot m_slots[capacity];
+    size_t m_used;
+    unsigned long long m_flushes;
+    unsigned long long m_updates;
+    unsigned long long m_applied;
+};
+
+
+inline deferred_thread_model::thread_log & deferred_thread_model::local()
+{
+    static thread_local thread_log current;
+    return current;
+}
+
+inline void deferred_thread_model::log(counter_type *c, int delta)
+{
+    local().add(c, delta);
+}
+
+inline void deferred_thread_model::flush()
+{
+    thread_log &log = local();
+    log.apply();
+    shared_state &s = state();
+    if (!s.stop_requested.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::unique_lock<std::mutex> guard(s.lock);
+    if (!s.stop_requested.load(std::memory_order_relaxed)) {
+        return;
+    }
+    // park until the collect that is waiting for us is over
+    unsigned long long generation = s.generation;
+    log.m_parked_generation = generation + 1;
+    s.changed.notify_all();
+    s.changed.wait(guard, [&s, generation]() { return s.generation != generation; });
+}
+
+inline size_t deferred_thread_model::collect()
+{
+    shared_state &s = state();
+    thread_log &self = local();
+    std::unique_lock<std::mutex> serialize(s.collect_lock, std::try_to_lock);
+    if (!serialize.owns_lock()) {
+        // waiting for the lock would stall the collect holding it
+        flush();
+        return 0;
+    }
+    self.apply();
+
+    unsigned long long generation;
+    {
+        std::unique_lock<std::mutex> guard(s.lock);
+        generation = s.generation;
+        s.stop_requested.store(true, std::memory_order_release);
+        s.changed.wait(guard, [&s, &self, generation]() {
+            for (size_t i = 0; i < s.threads.size(); ++i) {
+                thread_log *t = s.threads[i];
+                if (t != &self && t->m_online && t->m_parked_generation != generation + 1) {
+                    return false;
+                }
+            }
+            return true;
+        });
+    }
+
+    // every other thread has applied its log and is waiting: counts are exact.
+    // Destructors run here may drop further objects, keep going until quiet.
+    size_t reclaimed = 0;
+    for (;;) {
+        std::vector<counter_type *> batch;
+        {
+            std::lock_guard<std::mutex> guard(s.candidate_lock);
+            batch.swap(s.candidates);
+        }
+        if (batch.empty()) {
+            break;
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (batch[i]->reclaim()) {
+                ++reclaimed;
+            }
+        }
+        self.apply();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.stop_requested.store(false, std::memory_order_release);
+        ++s.generation;
+        s.changed.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> guard(s.stats_lock);
+        ++s.stats.collects;
+        s.stats.reclaimed += reclaimed;
+    }
+    return reclaimed;
+}
+
+inline void deferred_thread_model::go_offline()
+{
+    thread_log &log = local();
+    log.apply();
+    shared_state &s = state();
+    std::lock_guard<std::mutex> guard(s.lock);
+    log.m_online = false;
+    s.changed.notify_all();
+}
+
+inline void deferred_thread_model::go_online()
+{
+    thread_log &log = local();
+    shared_state &s = state();
+    std::unique_lock<std::mutex> guard(s.lock);
+    s.changed.wait(guard, [&s]() { return !s.stop_requested.load(std::memory_order_relaxed); });
+    log.m_online = true;
+}
+
+inline deferred_thread_model::statistics deferred_thread_model::get_statistics()
+{
+    local().publish_statistics();
+    shared_state &s = state();
+    std::lock_guard<std::mutex> guard(s.stats_lock);
+    return s.stats;
+}
+
+}; // namespace smart_ptr
+
+
+#endif // __DEFERRED_REF_COUNT_H__
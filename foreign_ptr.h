@@ -0,0 +1,203 @@
+/*
+* foreign_ptr - strong pointer to objects that count their own references.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* Many C libraries hand out reference counted handles with their own
+* ref/unref functions (GObject, codec contexts, buffer pools). Wrapping
+* them in strong_ptr with a mem_mgr like com_mem_mgr counts every handle
+* twice: a counter block is allocated next to the library's own count and
+* copies go to the block. A foreign_ptr has no block, it is the size of a
+* raw pointer and its copies call the library directly:
+*
+*     template <> struct foreign_ref_traits<GObject> {
+*         static void add_ref(GObject *p) { g_object_ref(p); }
+*         static void release(GObject *p) { g_object_unref(p); }
+*     };
+*     foreign_ptr<GObject> obj(adopt_ref_tag(), (GObject *)g_object_new(...));
+*
+* The plain constructor takes a new reference, the adopt_ref_tag one takes
+* over a reference the caller already owns, as returned by the library's
+* constructors. detach() gives one back without releasing it. Whether
+* copies may be shared between threads is up to the library's counting.
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __FOREIGN_PTR_H__
+#define __FOREIGN_PTR_H__
+
+#include <stddef.h>
+#include "smart_ptr.h"
+
+namespace smart_ptr {
+
+// Specialize for every foreign type, the default is for classes with
+// COM style AddRef()/Release() members.
+template <class T>
+struct foreign_ref_traits
+{
+    static void add_ref(T *p) { p->AddRef(); }
+    static void release(T *p) { p->Release(); }
+};
+
+// tag for constructors that take over a reference the caller owns
+struct adopt_ref_tag {};
+
+template <class T, typename ref_traits=foreign_ref_traits<T> >
+class foreign_ptr
+{
+public:
+    foreign_ptr() : m_ptr(0)
+    {
+    }
+
+    // takes a new reference to p
+    explicit foreign_ptr(T *p) : m_ptr(p)
+    {
+        if (m_ptr) {
+            ref_traits::add_ref(m_ptr);
+        }
+    }
+
+    // takes over the reference to p the caller owns
+    foreign_ptr(adopt_ref_tag, T *p) : m_ptr(p)
+    {
+    }
+
+    foreign_ptr(const foreign_ptr &rhs) : m_ptr(rhs.m_ptr)
+    {
+        if (m_ptr) {
+            ref_traits::add_ref(m_ptr);
+        }
+    }
+
+    template <class Q>
+    foreign_ptr(const foreign_ptr<Q, ref_traits> &rhs) : m_ptr(rhs.get())
+    {
+        if (m_ptr) {
+            ref_traits::add_ref(m_ptr);
+        }
+    }
+
+#if SMART_PTR_HAS_RVALUE_REFS
+    foreign_ptr(foreign_ptr &&rhs) : m_ptr(rhs.m_ptr)
+    {
+        rhs.m_ptr = 0;
+    }
+
+    foreign_ptr& operator=(foreign_ptr &&rhs)
+    {
+        if (this != &rhs) {
+            T *old = m_ptr;
+            m_ptr = rhs.m_ptr;
+            rhs.m_ptr = 0;
+            if (old) {
+                ref_traits::release(old);
+            }
+        }
+        return *this;
+    }
+#endif  // SMART_PTR_HAS_RVALUE_REFS
+
+    ~foreign_ptr()
+    {
+        if (m_ptr) {
+            ref_traits::release(m_ptr);
+        }
+    }
+
+    foreign_ptr& operator=(const foreign_ptr &rhs)
+    {
+        reset(rhs.m_ptr);
+        return *this;
+    }
+
+    template <class Q>
+    foreign_ptr& operator=(const foreign_ptr<Q, ref_traits> &rhs)
+    {
+        reset(rhs.get());
+        return *this;
+    }
+
+    operator T*()   const throw()   { return m_ptr; }
+    T& operator*()  const throw()   { return *m_ptr; }
+    T* operator->() const throw()   { return m_ptr; }
+    T* get()        const throw()   { return m_ptr; }
+
+    // point to p with a new reference, the new one is taken before the old is dropped
+    void reset(T *p=0)
+    {
+        if (p) {
+            ref_traits::add_ref(p);
+        }
+        T *old = m_ptr;
+        m_ptr = p;
+        if (old) {
+            ref_traits::release(old);
+        }
+    }
+
+    // point to p, taking over the reference the caller owns
+    void reset(adopt_ref_tag, T *p)
+    {
+        T *old = m_ptr;
+        m_ptr = p;
+        if (old) {
+            ref_traits::release(old);
+        }
+    }
+
+    // give up the reference without releasing it, to a library call that takes it over
+    T * detach() throw()
+    {
+        T *p = m_ptr;
+        m_ptr = 0;
+        return p;
+    }
+
+    void swap(foreign_ptr &rhs) throw()
+    {
+        T *tmp = m_ptr;
+        m_ptr = rhs.m_ptr;
+        rhs.m_ptr = tmp;
+    }
+
+private:
+    T * m_ptr;
+};
+
+template <class T, class Q, typename ref_traits>
+bool operator==(const foreign_ptr<T, ref_traits> &lhs, const foreign_ptr<Q, ref_traits> &rhs)
+{
+    return lhs.get() == rhs.get();
+}
+
+template <class T, class Q, typename ref_traits>
+bool operator!=(const foreign_ptr<T, ref_traits> &lhs, const foreign_ptr<Q, ref_traits> &rhs)
+{
+    return lhs.get() != rhs.get();
+}
+
+template <class T, class Q, typename ref_traits>
+bool operator<(const foreign_ptr<T, ref_traits> &lhs, const foreign_ptr<Q, ref_traits> &rhs)
+{
+    return lhs.get() < rhs.get();
+}
+
+}; // namespace smart_ptr
+
+
+#endif // __FOREIGN_PTR_H__
@@ -0,0 +1,464 @@
+/*
+* graph_snapshot - write a strong_ptr graph to a flat file and map it back in place.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* Every heap type T taking part describes a flat record type through
+* snapshot_traits<T>: plain data plus snapshot_ref<> links, which are byte
+* distances from the link itself, so the file is valid at any address.
+* snapshot_writer walks the graph breadth first and uses the counter block
+* (the object, for immortal pointers) as object identity, so an object owned by many pointers is written once
+* and all links to it point at the same record.
+*
+* snapshot_file maps such a file and hands out strong_ptrs to records
+* inside the mapping. They share one counter block per file and use
+* snapshot_mem_mgr, which frees nothing per object, so opening a snapshot
+* costs the same however many objects it holds: the mapping is released
+* when the file and the last record pointer are gone. The mapping is
+* read-only, and records are bounds checked when shared, not when a link
+* is followed by hand.
+*
+* Records are raw structs: a file is only readable by a build with the same
+* record layouts. Requires C++11, uses mmap on POSIX systems.
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __GRAPH_SNAPSHOT_H__
+#define __GRAPH_SNAPSHOT_H__
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+#include "smart_ptr.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif  // !defined(_WIN32)
+
+namespace smart_ptr {
+
+// Specialize for every heap type written to a snapshot:
+//
+//     template <> struct snapshot_traits<Node> {
+//         typedef FlatNode flat_type;
+//         static void write(const Node &n, FlatNode &f, snapshot_writer &w)
+//         { f.value = n.value; w.link(f.left, n.left); }
+//     };
+template <class T> struct snapshot_traits;
+
+
+// link between records of a snapshot, valid wherever the file is mapped
+template <class F>
+class snapshot_ref
+{
+public:
+    snapshot_ref() : m_offset(0)
+    {
+    }
+
+    F* get() const          { return m_offset ? (F *)((char *)this + m_offset) : 0; }
+    F& operator*() const    { return *get(); }
+    F* operator->() const   { return get(); }
+    operator F*() const     { return get(); }
+
+private:
+    long long m_offset;     // from this link to the record, 0 for null
+
+    friend class snapshot_writer;
+};
+
+
+class snapshot_writer
+{
+public:
+    snapshot_writer() : m_record(0), m_slot(0), m_objects(0)
+    {
+    }
+
+    // write the graph reachable from root, false on I/O failure
+    template <class T, typename mem_mgr, typename ref_counter>
+    bool save(const char *path, const strong_ptr<T, mem_mgr, ref_counter> &root)
+    {
+        build(root);
+        FILE *fp = fopen(path, "wb");
+        if (!fp) {
+            return false;
+        }
+        bool ok = fwrite(&m_buffer[0], 1, m_buffer.size(), fp) == m_buffer.size();
+        return (fclose(fp) == 0) && ok;
+    }
+
+    // lay out the graph in memory, returns the image written by save()
+    template <class T, typename mem_mgr, typename ref_counter>
+    const std::vector<char> & build(const strong_ptr<T, mem_mgr, ref_counter> &root)
+    {
+        m_buffer.assign(sizeof(file_header), 0);
+        m_seen.clear();
+        m_pending.clear();
+        m_objects = 0;
+
+        size_t root_slot = root.get() ? reserve<T>(root) : 0;
+        while (!m_pending.empty()) {
+            pending_record r = m_pending.front();
+            m_pending.pop_front();
+            r.write(*this, r.object, r.slot);
+        }
+
+        file_header *h = (file_header *)&m_buffer[0];
+        memcpy(h->magic, file_magic(), sizeof(h->magic));
+        h->root_offset = root_slot;
+        h->root_type = type_tag<typename snapshot_traits<T>::flat_type>();
+        h->object_count = m_objects;
+        h->file_size = m_buffer.size();
+        return m_buffer;
+    }
+
+    // point a link of the record being written at another object
+    template <class T, typename mem_mgr, typename ref_counter>
+    void link(snapshot_ref<typename snapshot_traits<T>::flat_type> &field,
+              const strong_ptr<T, mem_mgr, ref_counter> &target)
+    {
+        if (!target.get()) {
+            field.m_offset = 0;
+            return;
+        }
+        size_t slot;
+        std::unordered_map<const void *, size_t>::const_iterator it = m_seen.find(target.identity());
+        if (it != m_seen.end()) {
+            slot = it->second;
+        } else {
+            slot = reserve<T>(target);
+        }
+        size_t field_pos = m_slot + (size_t)((char *)&field - m_record);
+        field.m_offset = (long long)slot - (long long)field_pos;
+    }
+
+    size_t object_count() const
+    {
+        return m_objects;
+    }
+
+    struct file_header
+    {
+        char magic[8];
+        unsigned long long file_size;
+        unsigned long long root_offset;
+        unsigned long long root_type;
+        unsigned long long object_count;
+    };
+
+    static const char * file_magic()
+    {
+        return "SPSNAP1";
+    }
+
+    // fingerprint of a record type, records are only valid for the same build anyway
+    template <class F>
+    static unsigned long long type_tag()
+    {
+        unsigned long long h = 14695981039346656037ULL;
+        for (const char *p = typeid(F).name(); *p; ++p) {
+            h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+        }
+        return h ^ sizeof(F);
+    }
+
+private:
+    enum { alignment = 16 };
+
+    struct pending_record
+    {
+        const void *object;
+        size_t slot;
+        void (*write)(snapshot_writer &w, const void *object, size_t slot);
+    };
+
+    template <class T, typename mem_mgr, typename ref_counter>
+    size_t reserve(const strong_ptr<T, mem_mgr, ref_counter> &p)
+    {
+        typedef typename snapshot_traits<T>::flat_type flat_type;
+        size_t slot = (m_buffer.size() + alignment - 1) & ~(size_t)(alignment - 1);
+        m_buffer.resize(slot + sizeof(flat_type), 0);
+        m_seen[p.identity()] = slot;
+        pending_record r = { p.get(), slot, &write_record<T> };
+        m_pending.push_back(r);
+        ++m_objects;
+        return slot;
+    }
+
+    // fill a local record, links are computed against its final slot
+    template <class T>
+    static void write_record(snapshot_writer &w, const void *object, size_t slot)
+    {
+        typedef typename snapshot_traits<T>::flat_type flat_type;
+        flat_type f = flat_type();
+        w.m_record = (char *)&f;
+        w.m_slot = slot;
+        snapshot_traits<T>::write(*static_cast<const T *>(object), f, w);
+        memcpy(&w.m_buffer[slot], &f, sizeof(f));
+    }
+
+    std::vector<char> m_buffer;
+    std::unordered_map<const void *, size_t> m_seen;
+    std::deque<pending_record> m_pending;
+    char *m_record;
+    size_t m_slot;
+    size_t m_objects;
+};
+
+
+// Files mapped by snapshot_file, by address. A file's counter reaches 0
+// through whichever record pointer goes last, which only knows its record,
+// so that is looked up here to find the mapping to release.
+class snapshot_mappings
+{
+public:
+    static void add(char *base, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        mappings()[base] = size;
+    }
+
+    // release the mapping holding p
+    static void release(const void *p)
+    {
+        char *base = 0;
+        size_t size = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex());
+            std::map<char *, size_t>::iterator it = mappings().upper_bound((char *)p);
+            if (it == mappings().begin()) {
+                return;
+            }
+            --it;
+            if ((const char *)p >= it->first + it->second) {
+                return;
+            }
+            base = it->first;
+            size = it->second;
+            mappings().erase(it);
+        }
+        unmap(base, size);
+    }
+
+    // files still mapped
+    static size_t count()
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        return mappings().size();
+    }
+
+#if !defined(_WIN32)
+    static void unmap(char *base, size_t size)
+    {
+        munmap(base, size);
+    }
+#else
+    static void unmap(char *base, size_t)
+    {
+        delete [] base;
+    }
+#endif  // !defined(_WIN32)
+
+private:
+    static std::mutex & mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::map<char *, size_t> & mappings()
+    {
+        static std::map<char *, size_t> m;
+        return m;
+    }
+};
+
+// records live in the mapping, nothing to free per object; the last
+// pointer to a file releases the mapping
+template<typename T>
+class snapshot_mem_mgr {
+public:
+    static void deallocate(T *p)
+    {
+        snapshot_mappings::release(p);
+    }
+};
+
+template <typename ref_counter=ref_count>
+class snapshot_file
+{
+public:
+    snapshot_file() : m_base(0), m_size(0)
+    {
+    }
+
+    // pointers handed out keep the mapping until the last of them goes
+    ~snapshot_file()
+    {
+        close();
+    }
+
+    bool open(const char *path)
+    {
+        close();
+        if (!map(path)) {
+            return false;
+        }
+        const snapshot_writer::file_header *h = (const snapshot_writer::file_header *)m_base;
+        if (m_size < sizeof(*h) || memcmp(h->magic, snapshot_writer::file_magic(), sizeof(h->magic)) != 0
+            || h->file_size != m_size || h->root_offset >= m_size) {
+            snapshot_mappings::unmap(m_base, m_size);
+            m_base = 0;
+            m_size = 0;
+            return false;
+        }
+        snapshot_mappings::add(m_base, m_size);
+        m_owner.attach(m_base, new ref_counter);
+        return true;
+    }
+
+    void close()
+    {
+        if (!m_base) {
+            return;
+        }
+        m_owner.reset();
+        m_base = 0;
+        m_size = 0;
+    }
+
+    // root record, empty if F is not the type it was written as
+    template <class F>
+    strong_ptr<const F, snapshot_mem_mgr<const F>, ref_counter> root() const
+    {
+        const snapshot_writer::file_header *h = (const snapshot_writer::file_header *)m_base;
+        if (!m_base || !h->root_offset || h->root_type != snapshot_writer::type_tag<F>()) {
+            return strong_ptr<const F, snapshot_mem_mgr<const F>, ref_counter>();
+        }
+        return share((const F *)(m_base + h->root_offset));
+    }
+
+    // owning pointer to a record reached through links, sharing the file's
+    // counter; empty unless the whole record lies inside the file
+    template <class F>
+    strong_ptr<const F, snapshot_mem_mgr<const F>, ref_counter> share(const F *record) const
+    {
+        strong_ptr<const F, snapshot_mem_mgr<const F>, ref_counter> sp;
+        if (contains(record)) {
+            m_owner.get_counter()->inc_ref();
+            sp.attach(record, m_owner.get_counter());
+        }
+        return sp;
+    }
+
+    // the record a link points at, checked the same way
+    template <class F>
+    strong_ptr<const F, snapshot_mem_mgr<const F>, ref_counter> share(const snapshot_ref<F> &link) const
+    {
+        if (!contains(&link)) {
+            return strong_ptr<const F, snapshot_mem_mgr<const F>, ref_counter>();
+        }
+        return share((const F *)link.get());
+    }
+
+    size_t object_count() const
+    {
+        return m_base ? (size_t)((const snapshot_writer::file_header *)m_base)->object_count : 0;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    template <class F>
+    bool contains(const F *record) const
+    {
+        size_t at = (size_t)((const char *)record - m_base);
+        return record && m_base && (const char *)record >= m_base
+            && m_size >= sizeof(F) && at <= m_size - sizeof(F) && at % alignof(F) == 0;
+    }
+
+#if !defined(_WIN32)
+    bool map(const char *path)
+    {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        void *p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            p = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        m_base = (char *)p;
+        m_size = (size_t)st.st_size;
+        return true;
+    }
+#else
+    // no mmap here, read the image once; still no per-object work
+    bool map(const char *path)
+    {
+        FILE *fp = fopen(path, "rb");
+        if (!fp) {
+            return false;
+        }
+        fseek(fp, 0, SEEK_END);
+        long n = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        if (n <= 0) {
+            fclose(fp);
+            return false;
+        }
+        m_base = new char[n];
+        m_size = (size_t)n;
+        bool ok = fread(m_base, 1, m_size, fp) == m_size;
+        fclose(fp);
+        if (!ok) {
+            snapshot_mappings::unmap(m_base, m_size);
+            m_base = 0;
+        }
+        return ok;
+    }
+#endif  // !defined(_WIN32)
+
+    snapshot_file(const snapshot_file &);
+    snapshot_file & operator=(const snapshot_file &);
+
+    char *m_base;
+    size_t m_size;
+    strong_ptr<char, snapshot_mem_mgr<char>, ref_counter> m_owner;
+};
+
+}; // namespace smart_ptr
+
+
+#endif // __GRAPH_SNAPSHOT_H__
@@ -0,0 +1,278 @@
+/*
+* intern_ptr - flyweight factory handing out shared strong_ptrs for equal values.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* The table keeps a weak_ptr to every interned object, so an object lives
+* exactly as long as somebody outside the table owns it. Dead entries are
+* dropped when a lookup walks over them and by a sweep whenever a shard
+* doubles in size. Lookups lock only one of the shards, chosen by hash.
+*
+* Requires C++11 (std::mutex, std::unordered_multimap, std::hash).
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __INTERN_PTR_H__
+#define __INTERN_PTR_H__
+
+#include <stddef.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include "smart_ptr.h"
+
+namespace smart_ptr {
+
+// The returned pointers are shared between threads, so the counter
+// defaults to the interlocked one.
+template <typename T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=mt_ref_count,
+          typename hasher=std::hash<T>, typename key_equal=std::equal_to<T> >
+class intern_table
+{
+public:
+    typedef strong_ptr<T, mem_mgr, ref_counter> pointer_type;
+    typedef weak_ptr<T, mem_mgr, ref_counter> weak_type;
+
+    struct statistics
+    {
+        size_t hits;        // lookups answered with an existing object
+        size_t misses;      // lookups that allocated a new object
+        size_t purged;      // dead entries removed from the table
+        size_t entries;     // entries currently in the table, live or not
+
+        // fraction of lookups that did not need an allocation
+        double dedupe_ratio() const
+        {
+            size_t total = hits + misses;
+            return total ? (double)hits / (double)total : 0.0;
+        }
+    };
+
+    // shard_count is rounded up to a power of two
+    explicit intern_table(size_t shard_count=16) : m_shard_mask(0)
+    {
+        size_t n = 1;
+        while (n < shard_count) {
+            n <<= 1;
+        }
+        m_shards.reset(new shard[n]);
+        m_shard_mask = n - 1;
+    }
+
+    // return the live object equal to value, or a new copy of value
+    pointer_type intern(const T &value)
+    {
+        size_t h = m_hasher(value);
+        shard &s = shard_for(h);
+        std::lock_guard<std::mutex> guard(s.lock);
+
+        typename entry_map::iterator it = s.entries.find(h);
+        while (it != s.entries.end() && it->first == h) {
+            pointer_type sp = it->second.lock();
+            if (!sp) {
+                it = s.entries.erase(it);
+                ++s.purged;
+                continue;
+            }
+            if (m_equal(*sp, value)) {
+                ++s.hits;
+                return sp;
+            }
+            ++it;
+        }
+
+        pointer_type sp(mem_mgr::allocate(value));
+        s.entries.insert(std::make_pair(h, weak_type(sp)));
+        ++s.misses;
+        if (s.entries.size() >= s.sweep_at) {
+            sweep(s);
+        }
+        return sp;
+    }
+
+    template <typename A1>
+    pointer_type generate(A1 const &a1)
+    {
+        return intern(T(a1));
+    }
+
+    template <typename A1, typename A2>
+    pointer_type generate(A1 const &a1, A2 const &a2)
+    {
+        return intern(T(a1, a2));
+    }
+
+    template <typename A1, typename A2, typename A3>
+    pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3)
+    {
+        return intern(T(a1, a2, a3));
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4>
+    pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4)
+    {
+        return intern(T(a1, a2, a3, a4));
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4, typename A5>
+    pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5)
+    {
+        return intern(T(a1, a2, a3, a4, a5));
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
+    pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5, A6 const &a6)
+    {
+        return intern(T(a1, a2, a3, a4, a5, a6));
+    }
+
+    // remove every dead entry, return the number removed
+    size_t purge()
+    {
+        size_t nRs = 0;
+        for (size_t i = 0; i <= m_shard_mask; ++i) {
+            shard &s = m_shards[i];
+            std::lock_guard<std::mutex> guard(s.lock);
+            nRs += sweep(s);
+        }
+        return nRs;
+    }
+
+    statistics get_statistics() const
+    {
+        statistics st = { 0, 0, 0, 0 };
+        for (size_t i = 0; i <= m_shard_mask; ++i) {
+            shard &s = m_shards[i];
+            std::lock_guard<std::mutex> guard(s.lock);
+            st.hits += s.hits;
+            st.misses += s.misses;
+            st.purged += s.purged;
+            st.entries += s.entries.size();
+        }
+        return st;
+    }
+
+    // table used by make_interned_ptr
+    static intern_table & instance()
+    {
+        static intern_table table;
+        return table;
+    }
+
+private:
+    typedef std::unordered_multimap<size_t, weak_type> entry_map;
+
+    struct shard
+    {
+        shard() : sweep_at(64), hits(0), misses(0), purged(0) {}
+
+        std::mutex lock;
+        entry_map entries;
+        size_t sweep_at;
+        size_t hits;
+        size_t misses;
+        size_t purged;
+    };
+
+    shard & shard_for(size_t h) const
+    {
+        // the low bits pick the bucket inside the shard, use the high ones here
+        return m_shards[(h ^ (h >> 17) ^ (h >> 31)) & m_shard_mask];
+    }
+
+    // drop the dead entries of a locked shard
+    static size_t sweep(shard &s)
+    {
+        size_t nRs = 0;
+        typename entry_map::iterator it = s.entries.begin();
+        while (it != s.entries.end()) {
+            if (it->second.expired()) {
+                it = s.entries.erase(it);
+                ++nRs;
+            } else {
+                ++it;
+            }
+        }
+        s.purged += nRs;
+        s.sweep_at = (s.entries.size() < 32 ? 32 : s.entries.size()) * 2;
+        return nRs;
+    }
+
+    intern_table(const intern_table &);
+    intern_table & operator=(const intern_table &);
+
+    std::unique_ptr<shard[]> m_shards;
+    size_t m_shard_mask;
+    hasher m_hasher;
+    key_equal m_equal;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+//
+//   function make_interned_ptr group, the interning twin of make_strong_ptr
+//
+
+template <typename T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=mt_ref_count>
+class make_interned_ptr
+{
+public:
+    typedef intern_table<T, mem_mgr, ref_counter> table_type;
+    typedef typename table_type::pointer_type pointer_type;
+
+    template <typename A1>
+    static pointer_type generate(A1 const &a1)
+    {
+        return table_type::instance().generate(a1);
+    }
+
+    template <typename A1, typename A2>
+    static pointer_type generate(A1 const &a1, A2 const &a2)
+    {
+        return table_type::instance().generate(a1, a2);
+    }
+
+    template <typename A1, typename A2, typename A3>
+    static pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3)
+    {
+        return table_type::instance().generate(a1, a2, a3);
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4>
+    static pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4)
+    {
+        return table_type::instance().generate(a1, a2, a3, a4);
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4, typename A5>
+    static pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5)
+    {
+        return table_type::instance().generate(a1, a2, a3, a4, a5);
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
+    static pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5, A6 const &a6)
+    {
+        return table_type::instance().generate(a1, a2, a3, a4, a5, a6);
+    }
+};
+
+}; // namespace smart_ptr
+
+
+#endif // __INTERN_PTR_H__
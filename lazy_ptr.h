@@ -0,0 +1,271 @@
+/*
+* lazy_ptr - strong_ptr whose object is built on first use.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* make_lazy_ptr<T>::generate(a1, ...) keeps copies of the constructor
+* arguments instead of building T. The first get(), operator-> or
+* conversion to strong_ptr allocates it through mem_mgr, exactly once even
+* when threads race for it; afterwards an access is one acquire load.
+* Copies of a lazy_strong_ptr share the same pending object, so a member
+* copied around before first use still ends up with a single instance.
+*
+* prewarm() builds the objects of a whole range up front, optionally on
+* several threads, for services that would rather pay at startup.
+*
+* Requires C++11 (std::atomic, std::call_once, lambdas).
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __LAZY_PTR_H__
+#define __LAZY_PTR_H__
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "smart_ptr.h"
+
+namespace smart_ptr {
+
+// The built object may be shared between threads, so the counter defaults
+// to the interlocked one.
+template <class T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=mt_ref_count>
+class lazy_strong_ptr
+{
+public:
+    typedef strong_ptr<T, mem_mgr, ref_counter> pointer_type;
+    typedef weak_ptr<T, mem_mgr, ref_counter> weak_type;
+
+    // empty, get() returns 0
+    lazy_strong_ptr()
+    {
+    }
+
+    // an object that is already built
+    lazy_strong_ptr(const pointer_type &p) : m_cell(p.get() ? new ready_cell(p) : 0)
+    {
+    }
+
+    // build the object with f(), which returns a T* allocated the way mem_mgr frees it
+    template <typename factory_fn>
+    static lazy_strong_ptr from_factory(factory_fn f)
+    {
+        lazy_strong_ptr lp;
+        lp.m_cell.reset(new factory_cell<factory_fn>(f));
+        return lp;
+    }
+
+    T* get() const
+    {
+        cell *c = m_cell.get();
+        if (!c) {
+            return 0;
+        }
+        T *p = c->m_object.load(std::memory_order_acquire);
+        return p ? p : c->build();
+    }
+
+    T& operator*()  const   { return *get(); }
+    T* operator->() const   { return get(); }
+
+    // owning pointer to the object, building it if needed
+    pointer_type strong() const
+    {
+        return get() ? m_cell->m_owner : pointer_type();
+    }
+
+    operator pointer_type() const
+    {
+        return strong();
+    }
+
+    weak_type weak() const
+    {
+        return weak_type(strong());
+    }
+
+    // true once the object exists; does not build it
+    bool initialized() const
+    {
+        return m_cell.get() && m_cell->m_object.load(std::memory_order_acquire) != 0;
+    }
+
+    bool empty() const
+    {
+        return m_cell.get() == 0;
+    }
+
+    void reset()
+    {
+        m_cell.reset();
+    }
+
+private:
+    class cell
+    {
+    public:
+        cell() : m_object(0)
+        {
+        }
+
+        virtual ~cell()
+        {
+        }
+
+        T* build()
+        {
+            std::call_once(m_once, [this]() {
+                m_owner = pointer_type(create());
+                m_object.store(m_owner.get(), std::memory_order_release);
+            });
+            return m_object.load(std::memory_order_acquire);
+        }
+
+        // m_owner is written once, before m_object is published
+        std::atomic<T*> m_object;
+        pointer_type m_owner;
+
+    private:
+        virtual T* create() = 0;
+
+        std::once_flag m_once;
+    };
+
+    class ready_cell : public cell
+    {
+    public:
+        explicit ready_cell(const pointer_type &p)
+        {
+            this->m_owner = p;
+            this->m_object.store(p.get(), std::memory_order_release);
+        }
+
+    private:
+        virtual T* create() { return 0; }
+    };
+
+    template <typename factory_fn>
+    class factory_cell : public cell
+    {
+    public:
+        explicit factory_cell(const factory_fn &f) : m_factory(f)
+        {
+        }
+
+    private:
+        virtual T* create() { return m_factory(); }
+
+        factory_fn m_factory;
+    };
+
+    strong_ptr<cell, std_mem_mgr<cell>, mt_ref_count> m_cell;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+//
+//   function make_lazy_ptr group, the deferred twin of make_strong_ptr
+//
+
+template <typename T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=mt_ref_count>
+class make_lazy_ptr
+{
+public:
+    typedef lazy_strong_ptr<T, mem_mgr, ref_counter> pointer_type;
+
+    static pointer_type generate(void)
+    {
+        return pointer_type::from_factory([]() { return mem_mgr::allocate(); });
+    }
+
+    template <typename A1>
+    static pointer_type generate(A1 const &a1)
+    {
+        return pointer_type::from_factory([a1]() { return mem_mgr::allocate(a1); });
+    }
+
+    template <typename A1, typename A2>
+    static pointer_type generate(A1 const &a1, A2 const &a2)
+    {
+        return pointer_type::from_factory([a1, a2]() { return mem_mgr::allocate(a1, a2); });
+    }
+
+    template <typename A1, typename A2, typename A3>
+    static pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3)
+    {
+        return pointer_type::from_factory([a1, a2, a3]() { return mem_mgr::allocate(a1, a2, a3); });
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4>
+    static pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4)
+    {
+        return pointer_type::from_factory([a1, a2, a3, a4]() {
+            return mem_mgr::allocate(a1, a2, a3, a4);
+        });
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4, typename A5>
+    static pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5)
+    {
+        return pointer_type::from_factory([a1, a2, a3, a4, a5]() {
+            return mem_mgr::allocate(a1, a2, a3, a4, a5);
+        });
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
+    static pointer_type generate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5, A6 const &a6)
+    {
+        return pointer_type::from_factory([a1, a2, a3, a4, a5, a6]() {
+            return mem_mgr::allocate(a1, a2, a3, a4, a5, a6);
+        });
+    }
+};
+
+
+// build the objects of [first, last) now, spread over the given number of threads
+template <typename iterator>
+void prewarm(iterator first, iterator last, unsigned threads=1)
+{
+    if (threads <= 1) {
+        for (; first != last; ++first) {
+            first->get();
+        }
+        return;
+    }
+    std::vector<iterator> items;
+    for (; first != last; ++first) {
+        items.push_back(first);
+    }
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.push_back(std::thread([&items, &next]() {
+            for (size_t n = next++; n < items.size(); n = next++) {
+                items[n]->get();
+            }
+        }));
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+}
+
+}; // namespace smart_ptr
+
+
+#endif // __LAZY_PTR_H__
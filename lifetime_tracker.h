@@ -0,0 +1,550 @@
+/*
+* lifetime_tracker - opt-in registry of live objects owned by strong_ptr.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* Pointers whose counter is a tracked_ref_count register their counter
+* block when the object is first owned, with the object's type name and,
+* for sampled objects, a backtrace of the allocation site. The block takes
+* itself out again when it is deleted. report() and dump() list the
+* objects still alive grouped by allocation site, biggest first, and
+* flag those that are only owned from inside a strong cycle: like
+* cycle_collector, the check counts the references the tracked objects
+* hold on each other through the members reported by cycle_edges<T>, for
+* the types registered with trace_edges<T>(), and whatever is not
+* reachable from an object with an owner outside that set is garbage kept
+* alive by a cycle. Owners that are not tracked count as
+* outside owners, so nothing is flagged wrongly, but cycles are only seen
+* in full when every member is sampled.
+*
+* set_sample_rate(n) tracks one object in n, picked at random per thread;
+* the others cost one thread-local random number. 0 turns tracking off.
+* The live table is split in shards with a lock each, only sampled
+* objects touch it. The cycle check reads strong_ptr members of live
+* objects, take it while they are not being reassigned.
+*
+* Backtraces come from backtrace() (glibc, link with -rdynamic for
+* symbol names) or CaptureStackBackTrace (Windows), elsewhere sites are
+* told apart by type only. Requires C++11.
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __LIFETIME_TRACKER_H__
+#define __LIFETIME_TRACKER_H__
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+#include "smart_ptr.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#define SMART_PTR_HAS_BACKTRACE 1
+#endif
+#if defined(__GNUC__)
+#include <cxxabi.h>
+#endif  // defined(__GNUC__)
+
+#ifndef SMART_PTR_TRACKER_DEPTH
+#define SMART_PTR_TRACKER_DEPTH 16
+#endif  // SMART_PTR_TRACKER_DEPTH
+
+#ifndef SMART_PTR_TRACKER_SHARDS
+#define SMART_PTR_TRACKER_SHARDS 64
+#endif  // SMART_PTR_TRACKER_SHARDS
+
+// one in this many objects is tracked until set_sample_rate() says otherwise
+#ifndef SMART_PTR_TRACKER_SAMPLE_RATE
+#define SMART_PTR_TRACKER_SAMPLE_RATE 1
+#endif  // SMART_PTR_TRACKER_SAMPLE_RATE
+
+namespace smart_ptr {
+
+// see cycle_collector.h
+template <class T> struct cycle_edges;
+
+
+class lifetime_tracker
+{
+public:
+    struct statistics
+    {
+        unsigned long long created;     // counter blocks seen
+        unsigned long long sampled;     // of those, tracked
+        size_t live;                    // tracked and not yet deleted
+    };
+
+    // survivors of one allocation site
+    struct site_report
+    {
+        std::vector<void *> frames;
+        std::vector<std::string> types;
+        size_t objects;
+        size_t bytes;                   // object sizes plus their counter blocks
+        size_t in_cycles;               // only owned from inside strong cycles
+    };
+
+    static lifetime_tracker & instance()
+    {
+        // never destroyed, counter blocks may go away after static destructors ran
+        static lifetime_tracker *tracker = new lifetime_tracker;
+        return *tracker;
+    }
+
+    // track one object in rate, 0 for none
+    void set_sample_rate(unsigned rate)
+    {
+        m_rate.store(rate, std::memory_order_relaxed);
+    }
+
+    unsigned sample_rate() const
+    {
+        return m_rate.load(std::memory_order_relaxed);
+    }
+
+    statistics get_statistics() const
+    {
+        statistics s;
+        s.created = m_created.load(std::memory_order_relaxed);
+        s.sampled = m_sampled.load(std::memory_order_relaxed);
+        s.live = 0;
+        for (size_t i = 0; i < SMART_PTR_TRACKER_SHARDS; ++i) {
+            std::lock_guard<std::mutex> guard(m_shards[i].lock);
+            s.live += m_shards[i].records.size();
+        }
+        return s;
+    }
+
+    // live tracked objects grouped by allocation site, most bytes first
+    std::vector<site_report> report(bool check_cycles=true);
+
+    void dump(FILE *out=stderr, bool check_cycles=true);
+
+    // dump to out when the program exits
+    void dump_at_exit(FILE *out=stderr)
+    {
+        exit_output() = out;
+        static bool registered = false;
+        if (!registered) {
+            registered = true;
+            atexit(&exit_dump);
+        }
+    }
+
+    class edge_visitor;
+
+    // look for cycles through the members cycle_edges<T> reports; register
+    // each type once, where the specialization is visible
+    template <class T>
+    void trace_edges()
+    {
+        std::lock_guard<std::mutex> guard(m_edges_lock);
+        m_edges[typeid(T).name()] = &visit<T>;
+    }
+
+    // what the tracker knows about a live object, filled in by tracked_ref_count
+    struct record
+    {
+        void *object;
+        size_t size;
+        const char *type_name;
+        bool (*pin)(void *counter);                     // take a strong reference if alive
+        void (*unpin)(void *object, void *counter);     // and drop it
+        int (*use_count)(void *counter);
+        int depth;
+        void *frames[SMART_PTR_TRACKER_DEPTH];
+    };
+
+    // called at creation of every counter block, true if this one is tracked
+    bool sample()
+    {
+        m_created.fetch_add(1, std::memory_order_relaxed);
+        unsigned rate = m_rate.load(std::memory_order_relaxed);
+        if (rate == 0) {
+            return false;
+        }
+        if (rate > 1 && next_random() % rate != 0) {
+            return false;
+        }
+        m_sampled.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void add(const void *counter, const record &r)
+    {
+        shard &s = shard_of(counter);
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.records[counter] = r;
+    }
+
+    void remove(const void *counter)
+    {
+        shard &s = shard_of(counter);
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.records.erase(counter);
+    }
+
+#if defined(_MSC_VER)
+    __declspec(noinline)
+#elif defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    static int capture(void **frames, int depth)
+    {
+#if defined(_WIN32)
+        return (int)CaptureStackBackTrace(1, (DWORD)depth, frames, 0);
+#elif defined(SMART_PTR_HAS_BACKTRACE)
+        void *all[SMART_PTR_TRACKER_DEPTH + 1];
+        int n = backtrace(all, depth + 1);
+        n = n > 0 ? n - 1 : 0;      // not this function
+        memcpy(frames, all + 1, n * sizeof(void *));
+        return n;
+#else
+        (void)frames;
+        (void)depth;
+        return 0;
+#endif
+    }
+
+    // walks the strong_ptr members of an object, see report()
+    class edge_visitor
+    {
+    public:
+        template <class U, typename mem_mgr, typename ref_counter>
+        void operator()(base_ptr<U, true, mem_mgr, ref_counter> &p)
+        {
+            std::unordered_map<const void *, size_t>::const_iterator it = m_index->find(p.get_counter());
+            if (it == m_index->end()) {
+                return;
+            }
+            if (m_count_internal) {
+                (*m_internal)[it->second]++;
+            } else if (!(*m_live)[it->second]) {
+                (*m_live)[it->second] = true;
+                m_pending->push_back(it->second);
+            }
+        }
+
+        // weak edges own nothing
+        template <class U, typename mem_mgr, typename ref_counter>
+        void operator()(base_ptr<U, false, mem_mgr, ref_counter> &)
+        {
+        }
+
+    private:
+        friend class lifetime_tracker;
+
+        const std::unordered_map<const void *, size_t> *m_index;
+        bool m_count_internal;
+        std::vector<int> *m_internal;
+        std::vector<char> *m_live;
+        std::vector<size_t> *m_pending;
+    };
+
+private:
+    lifetime_tracker() : m_rate(SMART_PTR_TRACKER_SAMPLE_RATE), m_created(0), m_sampled(0)
+    {
+    }
+
+    struct shard
+    {
+        mutable std::mutex lock;
+        std::unordered_map<const void *, record> records;
+        char pad[SMART_PTR_CACHE_LINE_SIZE];
+    };
+
+    shard & shard_of(const void *counter)
+    {
+        size_t h = (size_t)counter;
+        h ^= h >> 7;
+        h ^= h >> 13;
+        return m_shards[h % SMART_PTR_TRACKER_SHARDS];
+    }
+
+    static unsigned next_random()
+    {
+        static thread_local unsigned state = 0;
+        if (state == 0) {
+            state = (unsigned)(size_t)&state | 1;
+        }
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    static FILE *& exit_output()
+    {
+        static FILE *out = 0;
+        return out;
+    }
+
+    static void exit_dump()
+    {
+        if (exit_output()) {
+            instance().dump(exit_output());
+        }
+    }
+
+    typedef void (*visit_function)(void *object, edge_visitor &v);
+
+    template <class T>
+    static void visit(void *object, edge_visitor &v)
+    {
+        cycle_edges<T>::visit(*static_cast<T *>(object), v);
+    }
+
+    std::mutex m_edges_lock;
+    std::map<std::string, visit_function> m_edges;      // by type name, see trace_edges()
+    std::atomic<unsigned> m_rate;
+    std::atomic<unsigned long long> m_created;
+    std::atomic<unsigned long long> m_sampled;
+    shard m_shards[SMART_PTR_TRACKER_SHARDS];
+};
+
+
+inline std::vector<lifetime_tracker::site_report> lifetime_tracker::report(bool check_cycles)
+{
+    // pin every live object, so none of them goes away while we look
+    std::vector<const void *> counters;
+    std::vector<record> live;
+    for (size_t i = 0; i < SMART_PTR_TRACKER_SHARDS; ++i) {
+        std::lock_guard<std::mutex> guard(m_shards[i].lock);
+        std::unordered_map<const void *, record>::const_iterator it;
+        for (it = m_shards[i].records.begin(); it != m_shards[i].records.end(); ++it) {
+            if (it->second.pin(const_cast<void *>(it->first))) {
+                counters.push_back(it->first);
+                live.push_back(it->second);
+            }
+        }
+    }
+
+    std::vector<char> reachable(live.size(), 1);
+    if (check_cycles) {
+        std::vector<visit_function> visit(live.size(), (visit_function)0);
+        {
+            std::lock_guard<std::mutex> guard(m_edges_lock);
+            for (size_t i = 0; i < live.size(); ++i) {
+                std::map<std::string, visit_function>::const_iterator it = m_edges.find(live[i].type_name);
+                if (it != m_edges.end()) {
+                    visit[i] = it->second;
+                }
+            }
+        }
+        std::unordered_map<const void *, size_t> index;
+        for (size_t i = 0; i < live.size(); ++i) {
+            index[counters[i]] = i;
+        }
+        std::vector<int> internal(live.size(), 0);
+        std::vector<size_t> pending;
+        edge_visitor v;
+        v.m_index = &index;
+        v.m_internal = &internal;
+        v.m_live = &reachable;
+        v.m_pending = &pending;
+
+        v.m_count_internal = true;
+        for (size_t i = 0; i < live.size(); ++i) {
+            if (visit[i]) {
+                visit[i](live[i].object, v);
+            }
+        }
+        // roots have owners outside the tracked set, our own pin aside
+        for (size_t i = 0; i < live.size(); ++i) {
+            reachable[i] = live[i].use_count(const_cast<void *>(counters[i])) - 1 > internal[i];
+            if (reachable[i]) {
+                pending.push_back(i);
+            }
+        }
+        v.m_count_internal = false;
+        while (!pending.empty()) {
+            size_t i = pending.back();
+            pending.pop_back();
+            if (visit[i]) {
+                visit[i](live[i].object, v);
+            }
+        }
+    }
+
+    // group by the frames, or by type where there are none
+    std::map<std::vector<void *>, size_t> by_site;
+    std::vector<site_report> sites;
+    std::vector<std::set<std::string> > types;
+    for (size_t i = 0; i < live.size(); ++i) {
+        std::vector<void *> key(live[i].frames, live[i].frames + live[i].depth);
+        if (key.empty()) {
+            key.push_back((void *)live[i].type_name);
+        }
+        std::map<std::vector<void *>, size_t>::iterator it = by_site.find(key);
+        if (it == by_site.end()) {
+            site_report s;
+            s.frames.assign(live[i].frames, live[i].frames + live[i].depth);
+            s.objects = s.bytes = s.in_cycles = 0;
+            it = by_site.insert(std::make_pair(key, sites.size())).first;
+            sites.push_back(s);
+            types.push_back(std::set<std::string>());
+        }
+        site_report &s = sites[it->second];
+        s.objects++;
+        s.bytes += live[i].size;
+        s.in_cycles += reachable[i] ? 0 : 1;
+
+        std::string name = live[i].type_name;
+#if defined(__GNUC__)
+        int status = 0;
+        char *readable = abi::__cxa_demangle(live[i].type_name, 0, 0, &status);
+        if (readable) {
+            name = readable;
+            free(readable);
+        }
+#endif  // defined(__GNUC__)
+        types[it->second].insert(name);
+    }
+    for (size_t i = 0; i < sites.size(); ++i) {
+        sites[i].types.assign(types[i].begin(), types[i].end());
+    }
+
+    for (size_t i = 0; i < live.size(); ++i) {
+        live[i].unpin(live[i].object, const_cast<void *>(counters[i]));
+    }
+
+    struct by_bytes
+    {
+        bool operator()(const site_report &a, const site_report &b) const { return a.bytes > b.bytes; }
+    };
+    std::stable_sort(sites.begin(), sites.end(), by_bytes());
+    return sites;
+}
+
+inline void lifetime_tracker::dump(FILE *out, bool check_cycles)
+{
+    std::vector<site_report> sites = report(check_cycles);
+    size_t objects = 0, bytes = 0, in_cycles = 0;
+    for (size_t i = 0; i < sites.size(); ++i) {
+        objects += sites[i].objects;
+        bytes += sites[i].bytes;
+        in_cycles += sites[i].in_cycles;
+    }
+    statistics st = get_statistics();
+    fprintf(out, "lifetime_tracker: %zu live objects, %zu bytes, %zu sites, %zu only owned by strong cycles"
+        " (sampling 1 in %u, %llu of %llu blocks tracked)\n",
+        objects, bytes, sites.size(), in_cycles, sample_rate(), st.sampled, st.created);
+    for (size_t i = 0; i < sites.size(); ++i) {
+        const site_report &s = sites[i];
+        fprintf(out, "site %zu: %zu objects, %zu bytes", i + 1, s.objects, s.bytes);
+        if (s.in_cycles) {
+            fprintf(out, ", %zu IN STRONG CYCLES", s.in_cycles);
+        }
+        fprintf(out, "\n    types:");
+        for (size_t t = 0; t < s.types.size(); ++t) {
+            fprintf(out, " %s", s.types[t].c_str());
+        }
+        fprintf(out, "\n");
+        fflush(out);
+#if defined(SMART_PTR_HAS_BACKTRACE)
+        if (!s.frames.empty()) {
+            char **names = backtrace_symbols((void * const *)&s.frames[0], (int)s.frames.size());
+            for (size_t f = 0; f < s.frames.size(); ++f) {
+                fprintf(out, "    #%zu %s\n", f, names ? names[f] : "?");
+            }
+            free(names);
+        }
+#else
+        for (size_t f = 0; f < s.frames.size(); ++f) {
+            fprintf(out, "    #%zu %p\n", f, s.frames[f]);
+        }
+#endif  // defined(SMART_PTR_HAS_BACKTRACE)
+    }
+    fflush(out);
+}
+
+
+// A counter that registers its object with lifetime_tracker::instance().
+// Use it as the ref_counter of the pointers to watch:
+//     typedef strong_ptr<Node, std_mem_mgr<Node>, tracked_ref_count<> > NodePtr;
+template <typename threading_model=multi_thread_model, typename layout=compact_layout, typename width=default_counts>
+class tracked_ref_count : public basic_ref_count<threading_model, layout, width>
+{
+    typedef basic_ref_count<threading_model, layout, width> baseClass;
+public:
+    tracked_ref_count() : m_tracked(false)
+    {
+    }
+
+    ~tracked_ref_count()
+    {
+        if (m_tracked) {
+            lifetime_tracker::instance().remove(this);
+        }
+    }
+
+    template <class T, typename mem_mgr>
+    void bind(T *p)
+    {
+        baseClass::template bind<T, mem_mgr>(p);
+        lifetime_tracker &tracker = lifetime_tracker::instance();
+        if (!tracker.sample()) {
+            return;
+        }
+        lifetime_tracker::record r;
+        r.object = const_cast<void *>(static_cast<const void *>(p));
+        r.size = sizeof(T) + sizeof(*this);
+        r.type_name = typeid(T).name();
+        r.pin = &pin;
+        r.unpin = &unpin<T, mem_mgr>;
+        r.use_count = &use_count;
+        r.depth = lifetime_tracker::capture(r.frames, SMART_PTR_TRACKER_DEPTH);
+        tracker.add(this, r);
+        m_tracked = true;
+    }
+
+private:
+    static bool pin(void *counter)
+    {
+        return static_cast<tracked_ref_count *>(counter)->inc_ref_if_alive();
+    }
+
+    template <class T, typename mem_mgr>
+    static void unpin(void *object, void *counter)
+    {
+        strong_ptr<T, mem_mgr, tracked_ref_count> sp;
+        sp.attach(static_cast<T *>(object), static_cast<tracked_ref_count *>(counter));
+    }
+
+    static int use_count(void *counter)
+    {
+        return static_cast<tracked_ref_count *>(counter)->get_ref_count();
+    }
+
+    bool m_tracked;
+};
+
+}; // namespace smart_ptr
+
+
+#endif // __LIFETIME_TRACKER_H__
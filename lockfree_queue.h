@@ -0,0 +1,269 @@
+/*
+* lockfree_queue - lock-free containers passing strong_ptr ownership between threads.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* Both containers take the pointer by move and keep only the raw object
+* pointer and its counter block while the element is inside, so a hop
+* through the container costs no reference count update at all.
+*
+* strong_ptr_queue is a bounded MPMC ring (Dmitry Vyukov's design): every
+* cell carries a sequence number, which rules out ABA, and cells are never
+* freed while the queue lives.
+*
+* strong_ptr_stack is a Treiber stack over a fixed node array. The head is
+* a 32-bit node index plus a 32-bit tag bumped on every change, so a stale
+* compare-exchange always fails. Nodes go back to a free list built the
+* same way and their memory is released only by the destructor, so a
+* thread reading a node it lost the race for still reads valid memory.
+*
+* The pointers must use a thread-safe counter such as mt_ref_count.
+* Requires C++11 (std::atomic).
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __LOCKFREE_QUEUE_H__
+#define __LOCKFREE_QUEUE_H__
+
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include "smart_ptr.h"
+
+namespace smart_ptr {
+
+template <class T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=mt_ref_count>
+class strong_ptr_queue
+{
+public:
+    typedef strong_ptr<T, mem_mgr, ref_counter> pointer_type;
+
+    // capacity is rounded up to a power of two
+    explicit strong_ptr_queue(size_t capacity=1024) : m_mask(0)
+    {
+        size_t n = 2;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        m_cells.reset(new cell[n]);
+        for (size_t i = 0; i < n; ++i) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        m_mask = n - 1;
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    ~strong_ptr_queue()
+    {
+        pointer_type p;
+        while (try_pop(p)) {
+            p.reset();
+        }
+    }
+
+    // move p into the queue; returns false and leaves p alone if the queue is full
+    bool try_push(pointer_type &&p)
+    {
+        cell *c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+            if (diff == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->ptr = p.detach(c->counter);
+        c->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // move the oldest element into p; returns false if the queue is empty
+    bool try_pop(pointer_type &p)
+    {
+        cell *c;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+            if (diff == 0) {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        T *ptr = c->ptr;
+        ref_counter *counter = c->counter;
+        c->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        // attach may destroy what p held, do it after the cell is handed back
+        p.attach(ptr, counter);
+        return true;
+    }
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+private:
+    struct cell
+    {
+        cell() : ptr(0), counter(0) {}
+
+        std::atomic<size_t> sequence;
+        T *ptr;
+        ref_counter *counter;
+    };
+
+    strong_ptr_queue(const strong_ptr_queue &);
+    strong_ptr_queue & operator=(const strong_ptr_queue &);
+
+    std::unique_ptr<cell[]> m_cells;
+    size_t m_mask;
+    // producers and consumers each spin on their own line
+    alignas(SMART_PTR_CACHE_LINE_SIZE) std::atomic<size_t> m_enqueue_pos;
+    alignas(SMART_PTR_CACHE_LINE_SIZE) std::atomic<size_t> m_dequeue_pos;
+};
+
+
+template <class T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=mt_ref_count>
+class strong_ptr_stack
+{
+public:
+    typedef strong_ptr<T, mem_mgr, ref_counter> pointer_type;
+
+    explicit strong_ptr_stack(size_t capacity=1024)
+        : m_nodes(new node[capacity ? capacity : 1])
+    {
+        if (capacity == 0) {
+            capacity = 1;
+        }
+        m_head.store(make_head(nil_index, 0), std::memory_order_relaxed);
+        m_free.store(make_head(nil_index, 0), std::memory_order_relaxed);
+        for (size_t i = capacity; i > 0; --i) {
+            push_index(m_free, (unsigned int)(i - 1));
+        }
+    }
+
+    ~strong_ptr_stack()
+    {
+        pointer_type p;
+        while (try_pop(p)) {
+            p.reset();
+        }
+    }
+
+    // move p onto the stack; returns false and leaves p alone if the stack is full
+    bool try_push(pointer_type &&p)
+    {
+        unsigned int idx = pop_index(m_free);
+        if (idx == nil_index) {
+            return false;
+        }
+        node &n = m_nodes[idx];
+        n.ptr = p.detach(n.counter);
+        push_index(m_head, idx);
+        return true;
+    }
+
+    // move the most recently pushed element into p; returns false if the stack is empty
+    bool try_pop(pointer_type &p)
+    {
+        unsigned int idx = pop_index(m_head);
+        if (idx == nil_index) {
+            return false;
+        }
+        T *ptr = m_nodes[idx].ptr;
+        ref_counter *counter = m_nodes[idx].counter;
+        push_index(m_free, idx);
+        p.attach(ptr, counter);
+        return true;
+    }
+
+private:
+    typedef unsigned long long head_type;
+    static const unsigned int nil_index = 0xFFFFFFFFu;
+
+    struct node
+    {
+        node() : ptr(0), counter(0), next(nil_index) {}
+
+        T *ptr;
+        ref_counter *counter;
+        std::atomic<unsigned int> next;
+    };
+
+    static head_type make_head(unsigned int idx, unsigned int tag)
+    {
+        return ((head_type)tag << 32) | idx;
+    }
+
+    void push_index(std::atomic<head_type> &head, unsigned int idx)
+    {
+        head_type old_head = head.load(std::memory_order_relaxed);
+        for (;;) {
+            m_nodes[idx].next.store((unsigned int)old_head, std::memory_order_relaxed);
+            head_type new_head = make_head(idx, (unsigned int)(old_head >> 32) + 1);
+            if (head.compare_exchange_weak(old_head, new_head,
+                    std::memory_order_release, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+
+    unsigned int pop_index(std::atomic<head_type> &head)
+    {
+        head_type old_head = head.load(std::memory_order_acquire);
+        for (;;) {
+            unsigned int idx = (unsigned int)old_head;
+            if (idx == nil_index) {
+                return nil_index;
+            }
+            // may read a node another thread already took, the tag makes the exchange fail then
+            unsigned int next = m_nodes[idx].next.load(std::memory_order_relaxed);
+            head_type new_head = make_head(next, (unsigned int)(old_head >> 32) + 1);
+            if (head.compare_exchange_weak(old_head, new_head,
+                    std::memory_order_acquire, std::memory_order_acquire)) {
+                return idx;
+            }
+        }
+    }
+
+    strong_ptr_stack(const strong_ptr_stack &);
+    strong_ptr_stack & operator=(const strong_ptr_stack &);
+
+    std::unique_ptr<node[]> m_nodes;
+    alignas(SMART_PTR_CACHE_LINE_SIZE) std::atomic<head_type> m_head;
+    alignas(SMART_PTR_CACHE_LINE_SIZE) std::atomic<head_type> m_free;
+};
+
+}; // namespace smart_ptr
+
+
+#endif // __LOCKFREE_QUEUE_H__
@@ -0,0 +1,231 @@
+/*
+* parallel_ptr - parallel algorithms over ranges of strong_ptr.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* Running std algorithms with an execution policy over a vector of
+* strong_ptr copies pointers into temporaries and comparator arguments,
+* and with mt_ref_count each copy is an interlocked operation on a line
+* other cores use too. These versions never copy an element:
+*
+* - parallel_for_each and parallel_transform hand the callback the raw
+*   object pointer, borrowed for the duration of the call; the range owns
+*   the objects meanwhile and must not be changed by anyone else.
+* - parallel_sort and parallel_partition detach every element into a
+*   (pointer, counter) pair, reorder the pairs and attach them back, so
+*   the counts are never touched; the comparator and predicate also get
+*   raw pointers.
+*
+* The range needs random access iterators. Work is split into one chunk
+* per thread; threads=0 means one per core. Requires C++11 (std::thread).
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __PARALLEL_PTR_H__
+#define __PARALLEL_PTR_H__
+
+#include <stddef.h>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "smart_ptr.h"
+
+namespace smart_ptr {
+
+namespace parallel_detail {
+
+    inline unsigned thread_count(unsigned threads, size_t n)
+    {
+        if (threads == 0) {
+            threads = std::thread::hardware_concurrency();
+        }
+        if (threads == 0) {
+            threads = 1;
+        }
+        // not worth a thread for less than a few thousand elements
+        size_t useful = n / 2048 + 1;
+        return (unsigned)std::min<size_t>(threads, useful);
+    }
+
+    // run fn(chunk, begin, end) over n elements cut in `chunks` pieces
+    template <typename chunk_fn>
+    void for_chunks(size_t n, unsigned chunks, chunk_fn fn)
+    {
+        if (chunks <= 1) {
+            fn(0, 0, n);
+            return;
+        }
+        size_t step = (n + chunks - 1) / chunks;
+        std::vector<std::thread> workers;
+        for (unsigned c = 1; c < chunks; ++c) {
+            size_t b = std::min(n, c * step);
+            size_t e = std::min(n, b + step);
+            workers.push_back(std::thread([fn, c, b, e]() { fn(c, b, e); }));
+        }
+        fn(0, 0, std::min(n, step));
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].join();
+        }
+    }
+
+    // an element taken out of its strong_ptr without touching the counts
+    template <typename pointer_type>
+    struct entry
+    {
+        typedef decltype(std::declval<pointer_type &>().get()) raw_pointer;
+        typedef decltype(std::declval<pointer_type &>().get_counter()) counter_pointer;
+
+        raw_pointer ptr;
+        counter_pointer counter;
+    };
+
+    template <typename iterator>
+    std::vector<entry<typename std::iterator_traits<iterator>::value_type> >
+    detach_all(iterator first, size_t n)
+    {
+        std::vector<entry<typename std::iterator_traits<iterator>::value_type> > entries(n);
+        for (size_t i = 0; i < n; ++i) {
+            entries[i].ptr = first[i].detach(entries[i].counter);
+        }
+        return entries;
+    }
+
+    template <typename iterator, typename entry_type>
+    void attach_all(iterator first, const std::vector<entry_type> &entries)
+    {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            first[i].attach(entries[i].ptr, entries[i].counter);
+        }
+    }
+
+} // namespace parallel_detail
+
+
+// fn(T*) for every element
+template <typename iterator, typename function>
+void parallel_for_each(iterator first, iterator last, function fn, unsigned threads=0)
+{
+    size_t n = (size_t)(last - first);
+    parallel_detail::for_chunks(n, parallel_detail::thread_count(threads, n),
+        [first, &fn](unsigned, size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) {
+                fn(first[i].get());
+            }
+        });
+}
+
+// out[i] = fn(T*) for every element, out must have room for the range
+template <typename iterator, typename out_iterator, typename function>
+out_iterator parallel_transform(iterator first, iterator last, out_iterator out, function fn, unsigned threads=0)
+{
+    size_t n = (size_t)(last - first);
+    parallel_detail::for_chunks(n, parallel_detail::thread_count(threads, n),
+        [first, out, &fn](unsigned, size_t b, size_t e) {
+            for (size_t i = b; i < e; ++i) {
+                out[i] = fn(first[i].get());
+            }
+        });
+    return out + n;
+}
+
+// sort by less(T*, T*): chunks are sorted in parallel, then merged pairwise
+template <typename iterator, typename compare>
+void parallel_sort(iterator first, iterator last, compare less, unsigned threads=0)
+{
+    typedef typename std::iterator_traits<iterator>::value_type pointer_type;
+    typedef parallel_detail::entry<pointer_type> entry_type;
+
+    size_t n = (size_t)(last - first);
+    unsigned chunks = parallel_detail::thread_count(threads, n);
+    std::vector<entry_type> entries = parallel_detail::detach_all(first, n);
+    auto entry_less = [&less](const entry_type &a, const entry_type &b) { return less(a.ptr, b.ptr); };
+
+    size_t step = (n + chunks - 1) / chunks;
+    parallel_detail::for_chunks(n, chunks, [&entries, &entry_less](unsigned, size_t b, size_t e) {
+        std::sort(entries.begin() + b, entries.begin() + e, entry_less);
+    });
+
+    std::vector<entry_type> merged(n);
+    for (size_t width = step; width < n; width *= 2) {
+        size_t pairs = (n + 2 * width - 1) / (2 * width);
+        parallel_detail::for_chunks(pairs, (unsigned)pairs,
+            [&entries, &merged, &entry_less, width, n](unsigned, size_t b, size_t e) {
+                for (size_t p = b; p < e; ++p) {
+                    size_t lo = p * 2 * width;
+                    size_t mid = std::min(n, lo + width);
+                    size_t hi = std::min(n, lo + 2 * width);
+                    std::merge(entries.begin() + lo, entries.begin() + mid,
+                        entries.begin() + mid, entries.begin() + hi,
+                        merged.begin() + lo, entry_less);
+                }
+            });
+        entries.swap(merged);
+    }
+    parallel_detail::attach_all(first, entries);
+}
+
+// stable partition by pred(T*), returns the first element for which it was false
+template <typename iterator, typename predicate>
+iterator parallel_partition(iterator first, iterator last, predicate pred, unsigned threads=0)
+{
+    typedef typename std::iterator_traits<iterator>::value_type pointer_type;
+    typedef parallel_detail::entry<pointer_type> entry_type;
+
+    size_t n = (size_t)(last - first);
+    unsigned chunks = parallel_detail::thread_count(threads, n);
+    std::vector<entry_type> entries = parallel_detail::detach_all(first, n);
+
+    // evaluate the predicate in parallel and count per chunk
+    std::vector<char> keep(n);
+    std::vector<size_t> kept(chunks);
+    parallel_detail::for_chunks(n, chunks, [&entries, &keep, &kept, &pred](unsigned c, size_t b, size_t e) {
+        size_t count = 0;
+        for (size_t i = b; i < e; ++i) {
+            keep[i] = pred(entries[i].ptr) ? 1 : 0;
+            count += keep[i];
+        }
+        kept[c] = count;
+    });
+
+    size_t total_kept = 0;
+    std::vector<size_t> true_at(kept.size()), false_at(kept.size());
+    for (size_t c = 0; c < kept.size(); ++c) {
+        true_at[c] = total_kept;
+        total_kept += kept[c];
+    }
+    size_t step = (n + kept.size() - 1) / kept.size();
+    for (size_t c = 0; c < kept.size(); ++c) {
+        false_at[c] = total_kept + std::min(n, c * step) - true_at[c];
+    }
+
+    std::vector<entry_type> placed(n);
+    parallel_detail::for_chunks(n, chunks,
+        [&entries, &keep, &placed, &true_at, &false_at](unsigned c, size_t b, size_t e) {
+            size_t t = true_at[c], f = false_at[c];
+            for (size_t i = b; i < e; ++i) {
+                placed[keep[i] ? t++ : f++] = entries[i];
+            }
+        });
+    parallel_detail::attach_all(first, placed);
+    return first + total_kept;
+}
+
+}; // namespace smart_ptr
+
+
+#endif // __PARALLEL_PTR_H__
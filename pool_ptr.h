@@ -0,0 +1,381 @@
+/*
+* pool_ptr - pooled objects that may be freed through a base or derived pointer.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* A mem_mgr only knows the static type of the pointer that drops the last
+* reference, so a strong_ptr<Base, pool_mem_mgr<Base> > converted from a
+* Derived would hand the memory back to the size class of Base.
+* allocation_ref_count records in the counter block, when the object is
+* created, where it came from: the complete object, its size and the
+* mem_mgr of the creating type. The last release goes back there, whatever
+* pointer type it comes through, so upcasts and downcasts between
+* strong_ptrs just work, and Base does not even need a virtual destructor:
+*
+*     typedef pool_strong_ptr<Shape> ShapePtr;
+*     ShapePtr s = make_pool_ptr<Circle>::generate(2.0);
+*
+* Create through the derived type (make_pool_ptr, or a pool_strong_ptr of
+* it) and convert afterwards; the type given to the first strong_ptr is the
+* one that is recorded. size_class_pool hands out blocks from per-thread
+* free lists in 16 byte steps up to 256 bytes, larger objects go to the heap.
+* Any other source with allocate(size)/deallocate(p, size) and an alignment
+* constant, an arena for example, can be plugged into pool_mem_mgr instead;
+* types aligned more strictly than their pool are refused at compile time.
+*
+* Requires C++11 (thread_local, std::mutex).
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __POOL_PTR_H__
+#define __POOL_PTR_H__
+
+#include <stddef.h>
+#include <new>
+#include <mutex>
+#include "smart_ptr.h"
+
+namespace smart_ptr {
+
+// Blocks freed on a thread go to that thread's list for their size class.
+// A list that grows past list_limit gives half to the class's global list,
+// an empty one takes the global list before cutting up a new chunk, and a
+// thread leaves its lists there when it exits. Chunks are never returned
+// to the heap. Blocks are 16 byte aligned.
+class size_class_pool
+{
+public:
+    enum {
+        granularity = 16,
+        classes = 16,
+        max_size = granularity * classes,
+        chunk_size = 64 * 1024,
+        list_limit = 1024,
+        alignment = granularity
+    };
+
+    static void * allocate(size_t size)
+    {
+        if (size > max_size) {
+            return ::operator new(size);
+        }
+        size_t c = size_class(size);
+        local_lists &l = local();
+        if (l.closed) {
+            return take_global(c);
+        }
+        if (!l.head[c]) {
+            refill(l, c);
+        }
+        block *b = l.head[c];
+        l.head[c] = b->next;
+        --l.count[c];
+        return b;
+    }
+
+    static void deallocate(void *p, size_t size)
+    {
+        if (!p) {
+            return;
+        }
+        if (size > max_size) {
+            ::operator delete(p);
+            return;
+        }
+        size_t c = size_class(size);
+        local_lists &l = local();
+        block *b = (block *)p;
+        if (l.closed) {
+            std::lock_guard<std::mutex> lock(global().mutex[c]);
+            b->next = global().head[c];
+            global().head[c] = b;
+            return;
+        }
+        register_owner(l);
+        if (l.count[c] == list_limit) {
+            spill(l, c, list_limit / 2);
+        }
+        b->next = l.head[c];
+        l.head[c] = b;
+        ++l.count[c];
+    }
+
+private:
+    struct block
+    {
+        block *next;
+    };
+
+    // trivially destructible, so it stays usable while other thread_local
+    // destructors still free objects; those go to the global lists once closed
+    struct local_lists
+    {
+        block *head[classes];
+        size_t count[classes];
+        bool registered;
+        bool closed;
+    };
+
+    struct global_lists
+    {
+        std::mutex mutex[classes];
+        block *head[classes];
+    };
+
+    struct local_owner
+    {
+        ~local_owner()
+        {
+            local_lists &l = local();
+            for (size_t c = 0; c < classes; ++c) {
+                if (l.count[c]) {
+                    spill(l, c, l.count[c]);
+                }
+            }
+            l.closed = true;
+        }
+    };
+
+    static size_t size_class(size_t size)
+    {
+        return size ? (size - 1) / granularity : 0;
+    }
+
+    static local_lists & local()
+    {
+        static thread_local local_lists l;
+        return l;
+    }
+
+    static void register_owner(local_lists &l)
+    {
+        if (!l.registered) {
+            l.registered = true;
+            static thread_local local_owner o;
+            (void)o;
+        }
+    }
+
+    static global_lists & global()
+    {
+        static global_lists g;
+        return g;
+    }
+
+    // move the first n blocks of class c to the global list
+    static void spill(local_lists &l, size_t c, size_t n)
+    {
+        block *first = l.head[c];
+        block *last = first;
+        for (size_t i = 1; i < n; ++i) {
+            last = last->next;
+        }
+        l.head[c] = last->next;
+        l.count[c] -= n;
+
+        std::lock_guard<std::mutex> lock(global().mutex[c]);
+        last->next = global().head[c];
+        global().head[c] = first;
+    }
+
+    static void refill(local_lists &l, size_t c)
+    {
+        register_owner(l);
+        {
+            std::lock_guard<std::mutex> lock(global().mutex[c]);
+            block *b = global().head[c];
+            global().head[c] = 0;
+            l.head[c] = b;
+            for (l.count[c] = 0; b; b = b->next) {
+                ++l.count[c];
+            }
+        }
+        if (l.head[c]) {
+            return;
+        }
+        l.count[c] = carve(c, l.head[c]);
+    }
+
+    // one block for a thread whose lists are closed, straight from the
+    // global list, since nothing would give its local list back
+    static void * take_global(size_t c)
+    {
+        std::lock_guard<std::mutex> lock(global().mutex[c]);
+        block *&head = global().head[c];
+        if (!head) {
+            carve(c, head);
+        }
+        block *b = head;
+        head = b->next;
+        return b;
+    }
+
+    // cut a new chunk into blocks of class c in front of list
+    static size_t carve(size_t c, block *&list)
+    {
+        size_t size = (c + 1) * granularity;
+        char *chunk = (char *)::operator new(chunk_size);
+        size_t n = chunk_size / size;
+        for (size_t i = n; i-- > 0; ) {
+            block *b = (block *)(chunk + i * size);
+            b->next = list;
+            list = b;
+        }
+        return n;
+    }
+};
+
+// a mem_mgr drawing T from pool, see allocation_ref_count for freeing it
+// through another type
+template <typename T, typename pool=size_class_pool>
+class pool_mem_mgr {
+    static_assert(alignof(T) <= (size_t)pool::alignment, "T is aligned more strictly than the pool's blocks");
+
+    // gives the memory back if the constructor throws
+    struct raw_block
+    {
+        raw_block() : p(pool::allocate(sizeof(T))) {}
+        ~raw_block() { if (p) pool::deallocate(p, sizeof(T)); }
+        void *release() { void *r = p; p = 0; return r; }
+        void *p;
+    };
+
+public:
+    static void deallocate(T *p)
+    {
+        p->~T();
+        pool::deallocate(const_cast<void *>(static_cast<const void *>(p)), sizeof(T));
+    }
+
+    static T * allocate(void) { raw_block b; new (b.p) T(); return (T *)b.release(); }
+    template<typename A1> static T * allocate(A1 const &a1) { raw_block b; new (b.p) T(a1); return (T *)b.release(); }
+    template<typename A1, typename A2> static T * allocate(A1 const &a1, A2 const &a2) { raw_block b; new (b.p) T(a1, a2); return (T *)b.release(); }
+    template<typename A1, typename A2, typename A3> static T * allocate(A1 const &a1, A2 const &a2, A3 const &a3) { raw_block b; new (b.p) T(a1, a2, a3); return (T *)b.release(); }
+    template<typename A1, typename A2, typename A3, typename A4> static T * allocate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4) { raw_block b; new (b.p) T(a1, a2, a3, a4); return (T *)b.release(); }
+    template<typename A1, typename A2, typename A3, typename A4, typename A5> static T * allocate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5) { raw_block b; new (b.p) T(a1, a2, a3, a4, a5); return (T *)b.release(); }
+    template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6> static T * allocate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5, A6 const &a6) { raw_block b; new (b.p) T(a1, a2, a3, a4, a5, a6); return (T *)b.release(); }
+};
+
+// where an object came from: how to free it as its created type, and its size
+struct allocation_source
+{
+    void (*destroy)(void *object);
+    size_t size;
+};
+
+template <class T, typename mem_mgr>
+struct allocation_source_of
+{
+    static void destroy(void *object)
+    {
+        mem_mgr::deallocate(static_cast<T *>(object));
+    }
+
+    static const allocation_source source;
+};
+
+template <class T, typename mem_mgr>
+const allocation_source allocation_source_of<T, mem_mgr>::source = { &allocation_source_of<T, mem_mgr>::destroy, sizeof(T) };
+
+// where allocation_ref_count blocks come from, the cache line layouts keep
+// their aligned ones
+template <typename layout>
+struct allocation_block_source
+{
+    static void * allocate(size_t size)             { return size_class_pool::allocate(size); }
+    static void deallocate(void *p, size_t size)    { size_class_pool::deallocate(p, size); }
+};
+
+template <>
+struct allocation_block_source<cache_line_layout>
+{
+    static void * allocate(size_t size)             { return cache_line_aligned::operator new(size); }
+    static void deallocate(void *p, size_t)         { cache_line_aligned::operator delete(p); }
+};
+
+template <>
+struct allocation_block_source<split_layout> : public allocation_block_source<cache_line_layout>
+{
+};
+
+// A counter that frees the object through the type and mem_mgr it was
+// created with, two words more than the counter it extends. Its blocks
+// come from the pool as well.
+template <typename threading_model=multi_thread_model, typename layout=compact_layout, typename width=default_counts>
+class allocation_ref_count : public basic_ref_count<threading_model, layout, width>
+{
+public:
+    static void * operator new(size_t size)
+    {
+        return allocation_block_source<layout>::allocate(size);
+    }
+
+    static void operator delete(void *p, size_t size)
+    {
+        allocation_block_source<layout>::deallocate(p, size);
+    }
+
+    SMART_PTR_CONSTEXPR allocation_ref_count() : m_object(0), m_source(0)
+    {
+    }
+
+    template <class T, typename mem_mgr>
+    void bind(T *p)
+    {
+        m_object = const_cast<void *>(static_cast<const void *>(p));
+        m_source = &allocation_source_of<T, mem_mgr>::source;
+    }
+
+    template <class T, typename mem_mgr>
+    void destroy(T *p)
+    {
+        if (m_source) {
+            m_source->destroy(m_object);
+        } else {
+            mem_mgr::deallocate(p);
+        }
+    }
+
+    // the recorded source, 0 for blocks no object was created with
+    const allocation_source * source() const
+    {
+        return m_source;
+    }
+
+    // size of the object as created
+    size_t allocated_size() const
+    {
+        return m_source ? m_source->size : 0;
+    }
+
+private:
+    void *m_object;
+    const allocation_source *m_source;
+};
+
+template <class T> using pool_strong_ptr = strong_ptr<T, pool_mem_mgr<T>, allocation_ref_count<> >;
+template <class T> using pool_weak_ptr = weak_ptr<T, pool_mem_mgr<T>, allocation_ref_count<> >;
+
+// make_pool_ptr<Circle>::generate(2.0), a pool_strong_ptr<Circle>
+template <typename T>
+class make_pool_ptr : public make_strong_ptr<T, pool_mem_mgr<T>, allocation_ref_count<> >
+{
+};
+
+}; // namespace smart_ptr
+
+
+#endif // __POOL_PTR_H__
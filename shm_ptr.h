@@ -0,0 +1,696 @@
+/*
+* shm_ptr - strong_ptr to objects living in a POSIX shared memory segment.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* Both the object and its counter block are allocated inside the segment,
+* so every process that maps the segment shares one pair of counts and the
+* last owner in any process frees the object. Inside the segment everything
+* is an offset from the segment base, since each process maps it at its
+* own address; the strong_ptr handles themselves live in process memory
+* and hold ordinary pointers into the local mapping.
+*
+* References cross process boundaries as shm_handle values (two offsets):
+* share() adds a reference that travels with the handle and adopt() takes
+* it over on the other side. A named directory in the segment header offers
+* the same through publish()/lookup()/unpublish().
+*
+* Objects must not contain pointers other than shm_offset_ptr. A process
+* that dies while owning references leaks them; one that dies inside the
+* segment lock may also leave the heap damaged, see damaged(). Keep the
+* shm_segment object alive for as long as the process holds pointers into it.
+*
+* POSIX only (shm_open, mmap, process-shared pthread mutex), requires C++11.
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __SHM_PTR_H__
+#define __SHM_PTR_H__
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "smart_ptr.h"
+
+namespace smart_ptr {
+
+// reference to a shared object that can be passed to another process
+struct shm_handle
+{
+    size_t counter;     // offsets from the segment base, 0 for null
+    size_t object;
+};
+
+class shm_segment
+{
+public:
+    enum { directory_size = 32, max_name_length = 47, alignment = 16 };
+
+    shm_segment() : m_base(0), m_size(0)
+    {
+    }
+
+    ~shm_segment()
+    {
+        close();
+    }
+
+    // create a new segment, fails if the name already exists
+    bool create(const char *name, size_t size)
+    {
+        close();
+        size = (size + 4095) & ~(size_t)4095;
+        if (size < sizeof(header) + 4096) {
+            return false;
+        }
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        if (ftruncate(fd, (off_t)size) != 0 || !map(fd, size)) {
+            ::close(fd);
+            shm_unlink(name);
+            return false;
+        }
+        ::close(fd);
+
+        header *h = get_header();
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&h->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+
+        h->size = size;
+        h->damaged = 0;
+        h->bytes_in_use = 0;
+        memset(h->directory, 0, sizeof(h->directory));
+        size_t first = align(sizeof(header));
+        block *b = block_at(first);
+        b->size = size - first;
+        b->next = 0;
+        h->free_head = first;
+
+        // openers check the magic last, after everything else is in place
+        __atomic_store_n(&h->magic, (unsigned int)segment_magic, __ATOMIC_RELEASE);
+        register_segment(this);
+        return true;
+    }
+
+    // map an existing segment created by another process
+    bool open(const char *name)
+    {
+        close();
+        int fd = shm_open(name, O_RDWR, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header) || !map(fd, (size_t)st.st_size)) {
+            ::close(fd);
+            return false;
+        }
+        ::close(fd);
+        if (__atomic_load_n(&get_header()->magic, __ATOMIC_ACQUIRE) != segment_magic) {
+            close();
+            return false;
+        }
+        register_segment(this);
+        return true;
+    }
+
+    // unmap the segment; pointers into it must be gone by now
+    void close()
+    {
+        if (m_base) {
+            unregister_segment(this);
+            munmap(m_base, m_size);
+            m_base = 0;
+            m_size = 0;
+        }
+    }
+
+    // remove the name, the memory goes away with the last mapping
+    static bool remove(const char *name)
+    {
+        return shm_unlink(name) == 0;
+    }
+
+    bool is_open() const
+    {
+        return m_base != 0;
+    }
+
+    bool contains(const void *p) const
+    {
+        return m_base && (const char *)p >= m_base && (const char *)p < m_base + m_size;
+    }
+
+    // first-fit allocation from the segment heap, 0 when out of space
+    void * allocate(size_t n)
+    {
+        size_t need = align(sizeof(block) + (n ? n : 1));
+        locker guard(this);
+        header *h = get_header();
+        if (h->damaged) {
+            return 0;
+        }
+        size_t prev = 0;
+        size_t cur = h->free_head;
+        while (cur) {
+            block *b = block_at(cur);
+            if (b->size >= need) {
+                size_t next = b->next;
+                if (b->size - need >= sizeof(block) + alignment) {
+                    block *rest = block_at(cur + need);
+                    rest->size = b->size - need;
+                    rest->next = b->next;
+                    next = cur + need;
+                    b->size = need;
+                }
+                if (prev) {
+                    block_at(prev)->next = next;
+                } else {
+                    h->free_head = next;
+                }
+                b->next = 0;
+                h->bytes_in_use += b->size;
+                return (char *)b + sizeof(block);
+            }
+            prev = cur;
+            cur = b->next;
+        }
+        return 0;
+    }
+
+    // return memory to the heap, merging with free neighbours
+    void deallocate(void *p)
+    {
+        if (!p) {
+            return;
+        }
+        size_t off = offset_of(p) - sizeof(block);
+        locker guard(this);
+        header *h = get_header();
+        if (h->damaged) {
+            return;
+        }
+        block *b = block_at(off);
+        h->bytes_in_use -= b->size;
+
+        // the free list is kept sorted by offset
+        size_t prev = 0;
+        size_t cur = h->free_head;
+        while (cur && cur < off) {
+            prev = cur;
+            cur = block_at(cur)->next;
+        }
+        b->next = cur;
+        if (cur && off + b->size == cur) {
+            b->size += block_at(cur)->size;
+            b->next = block_at(cur)->next;
+        }
+        if (prev) {
+            block *pb = block_at(prev);
+            if (prev + pb->size == off) {
+                pb->size += b->size;
+                pb->next = b->next;
+            } else {
+                pb->next = off;
+            }
+        } else {
+            h->free_head = off;
+        }
+    }
+
+    // true once a process died holding the segment lock and the heap could
+    // not be verified afterwards; allocation fails and frees are dropped from
+    // then on, objects already allocated stay usable
+    bool damaged()
+    {
+        locker guard(this);
+        return get_header()->damaged != 0;
+    }
+
+    size_t bytes_in_use()
+    {
+        locker guard(this);
+        return get_header()->bytes_in_use;
+    }
+
+    size_t offset_of(const void *p) const
+    {
+        return p ? (size_t)((const char *)p - m_base) : 0;
+    }
+
+    void * address_of(size_t offset) const
+    {
+        return offset ? m_base + offset : 0;
+    }
+
+    // hand out a reference for another process, it travels with the handle
+    template <class T, typename mem_mgr, typename ref_counter>
+    shm_handle share(const strong_ptr<T, mem_mgr, ref_counter> &p)
+    {
+        strong_ptr<T, mem_mgr, ref_counter> copy(p);
+        ref_counter *counter;
+        T *obj = copy.detach(counter);
+        shm_handle h = { offset_of(counter), offset_of(obj) };
+        return h;
+    }
+
+    // take over the reference carried by a handle from share()
+    template <class T, typename mem_mgr, typename ref_counter>
+    void adopt(const shm_handle &h, strong_ptr<T, mem_mgr, ref_counter> &p)
+    {
+        p.attach(static_cast<T *>(address_of(h.object)), static_cast<ref_counter *>(address_of(h.counter)));
+    }
+
+    // store a reference under a name, false if the name is taken or the directory is full
+    template <class T, typename mem_mgr, typename ref_counter>
+    bool publish(const char *name, const strong_ptr<T, mem_mgr, ref_counter> &p)
+    {
+        if (!p.get() || strlen(name) > max_name_length) {
+            return false;
+        }
+        shm_handle h = share(p);
+        {
+            locker guard(this);
+            header *hd = get_header();
+            directory_entry *slot = 0;
+            for (int i = 0; i < directory_size; ++i) {
+                directory_entry &e = hd->directory[i];
+                if (e.handle.object && strcmp(e.name, name) == 0) {
+                    slot = 0;
+                    break;
+                }
+                if (!e.handle.object && !slot) {
+                    slot = &e;
+                }
+            }
+            if (slot) {
+                strcpy(slot->name, name);
+                slot->handle = h;
+                slot->object_size = sizeof(T);
+                return true;
+            }
+        }
+        strong_ptr<T, mem_mgr, ref_counter> drop;
+        adopt(h, drop);
+        return false;
+    }
+
+    // new reference to a published object, empty if there is none of that size
+    template <class T, typename mem_mgr, typename ref_counter>
+    bool lookup(const char *name, strong_ptr<T, mem_mgr, ref_counter> &p)
+    {
+        locker guard(this);
+        directory_entry *e = find_entry(name);
+        if (!e || e->object_size != sizeof(T)) {
+            return false;
+        }
+        // the directory owns a reference, the count cannot drop to 0 under the lock
+        static_cast<ref_counter *>(address_of(e->handle.counter))->inc_ref();
+        adopt(e->handle, p);
+        return true;
+    }
+
+    // drop the directory's reference to a published object
+    template <class T, typename mem_mgr, typename ref_counter>
+    bool unpublish(const char *name, strong_ptr<T, mem_mgr, ref_counter> &released)
+    {
+        shm_handle h;
+        {
+            locker guard(this);
+            directory_entry *e = find_entry(name);
+            if (!e || e->object_size != sizeof(T)) {
+                return false;
+            }
+            h = e->handle;
+            memset(e, 0, sizeof(*e));
+        }
+        // released outside the lock, freeing the object takes it again
+        adopt(h, released);
+        released.reset();
+        return true;
+    }
+
+    // segment mapping the address, 0 if none in this process does
+    static shm_segment * from_address(const void *p)
+    {
+        std::lock_guard<std::mutex> guard(registry_lock());
+        std::vector<shm_segment *> &segments = registry();
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (segments[i]->contains(p)) {
+                return segments[i];
+            }
+        }
+        return 0;
+    }
+
+private:
+    enum { segment_magic = 0x53484d51 };
+
+    struct block
+    {
+        size_t size;        // including this header
+        size_t next;        // next free block while on the free list
+    };
+
+    struct directory_entry
+    {
+        char name[max_name_length + 1];
+        shm_handle handle;
+        size_t object_size;
+    };
+
+    struct header
+    {
+        unsigned int magic;
+        unsigned int damaged;
+        size_t size;
+        pthread_mutex_t lock;
+        size_t free_head;
+        size_t bytes_in_use;
+        directory_entry directory[directory_size];
+    };
+
+    class locker
+    {
+    public:
+        explicit locker(shm_segment *seg) : m_lock(&seg->get_header()->lock)
+        {
+            // a holder died inside the lock, maybe halfway through changing
+            // the free list; only a heap that checks out is used again
+            if (pthread_mutex_lock(m_lock) == EOWNERDEAD) {
+                if (!seg->heap_consistent()) {
+                    seg->get_header()->damaged = 1;
+                }
+                pthread_mutex_consistent(m_lock);
+            }
+        }
+        ~locker()
+        {
+            pthread_mutex_unlock(m_lock);
+        }
+    private:
+        pthread_mutex_t *m_lock;
+    };
+
+    // The blocks must tile the heap and the free list must be a sorted
+    // chain of some of them; bytes_in_use is recounted from that. A holder
+    // killed in the middle of allocate() may still have leaked a block.
+    bool heap_consistent()
+    {
+        header *h = get_header();
+        if (h->size != m_size) {
+            return false;
+        }
+        size_t next_free = h->free_head;
+        size_t in_use = 0;
+        size_t n;
+        for (size_t off = align(sizeof(header)); off != h->size; off += n) {
+            n = block_at(off)->size;
+            if (n < sizeof(block) || n % alignment || n > h->size - off) {
+                return false;
+            }
+            if (off == next_free) {
+                next_free = block_at(off)->next;
+                if (next_free && next_free <= off) {
+                    return false;
+                }
+            } else if (next_free && next_free < off) {
+                return false;
+            } else {
+                in_use += n;
+            }
+        }
+        if (next_free) {
+            return false;
+        }
+        h->bytes_in_use = in_use;
+        return true;
+    }
+
+    static size_t align(size_t n)
+    {
+        return (n + alignment - 1) & ~(size_t)(alignment - 1);
+    }
+
+    bool map(int fd, size_t size)
+    {
+        void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        m_base = (char *)p;
+        m_size = size;
+        return true;
+    }
+
+    header * get_header() const
+    {
+        return (header *)m_base;
+    }
+
+    block * block_at(size_t offset) const
+    {
+        return (block *)(m_base + offset);
+    }
+
+    directory_entry * find_entry(const char *name)
+    {
+        header *h = get_header();
+        for (int i = 0; i < directory_size; ++i) {
+            if (h->directory[i].handle.object && strcmp(h->directory[i].name, name) == 0) {
+                return &h->directory[i];
+            }
+        }
+        return 0;
+    }
+
+    static std::mutex & registry_lock()
+    {
+        static std::mutex lock;
+        return lock;
+    }
+
+    static std::vector<shm_segment *> & registry()
+    {
+        static std::vector<shm_segment *> segments;
+        return segments;
+    }
+
+    static void register_segment(shm_segment *seg)
+    {
+        std::lock_guard<std::mutex> guard(registry_lock());
+        registry().push_back(seg);
+    }
+
+    static void unregister_segment(shm_segment *seg)
+    {
+        std::lock_guard<std::mutex> guard(registry_lock());
+        std::vector<shm_segment *> &segments = registry();
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (segments[i] == seg) {
+                segments.erase(segments.begin() + i);
+                break;
+            }
+        }
+    }
+
+    shm_segment(const shm_segment &);
+    shm_segment & operator=(const shm_segment &);
+
+    char *m_base;
+    size_t m_size;
+};
+
+
+// counter block living in the segment; the counts are lock-free atomics,
+// which work across processes because they do not depend on the address
+class shm_ref_count : public basic_ref_count<multi_thread_model>
+{
+public:
+    // only ever created in segment memory by make_shm_ptr; a strong_ptr
+    // built from a raw pointer would put its counter in process memory,
+    // so that does not compile
+    static void * operator new(size_t) = delete;
+    static void * operator new(size_t, void *where) { return where; }
+    static void operator delete(void *, void *) {}
+
+    static void operator delete(void *p)
+    {
+        shm_segment *seg = shm_segment::from_address(p);
+        if (seg) {
+            seg->deallocate(p);
+        }
+    }
+
+};
+
+template<typename T>
+class shm_mem_mgr {
+public:
+    static void deallocate(T *p)
+    {
+        shm_segment *seg = shm_segment::from_address(p);
+        p->~T();
+        if (seg) {
+            seg->deallocate(p);
+        }
+    }
+};
+
+template <class T> using shm_strong_ptr = strong_ptr<T, shm_mem_mgr<T>, shm_ref_count>;
+template <class T> using shm_weak_ptr = weak_ptr<T, shm_mem_mgr<T>, shm_ref_count>;
+
+
+// self-relative pointer for links between objects inside one segment
+template <class T>
+class shm_offset_ptr
+{
+public:
+    shm_offset_ptr() : m_offset(1)
+    {
+    }
+
+    shm_offset_ptr(T *p)
+    {
+        set(p);
+    }
+
+    shm_offset_ptr(const shm_offset_ptr &rhs)
+    {
+        set(rhs.get());
+    }
+
+    shm_offset_ptr & operator=(const shm_offset_ptr &rhs)
+    {
+        set(rhs.get());
+        return *this;
+    }
+
+    shm_offset_ptr & operator=(T *p)
+    {
+        set(p);
+        return *this;
+    }
+
+    T* get() const          { return m_offset == 1 ? 0 : (T *)((char *)this + m_offset); }
+    T& operator*() const    { return *get(); }
+    T* operator->() const   { return get(); }
+    operator T*() const     { return get(); }
+
+private:
+    // a pointer to the byte right after itself is of no use, so 1 stands for null
+    void set(T *p)
+    {
+        m_offset = p ? (char *)p - (char *)this : 1;
+    }
+
+    ptrdiff_t m_offset;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+//
+//   function make_shm_ptr group
+//
+
+template <typename T>
+class make_shm_ptr
+{
+    static_assert(alignof(T) <= (size_t)shm_segment::alignment, "T is aligned more strictly than the segment's blocks");
+
+public:
+    typedef shm_strong_ptr<T> pointer_type;
+
+    static pointer_type generate(shm_segment &seg)
+    {
+        void *mem = seg.allocate(sizeof(T));
+        return mem ? wrap(seg, new (mem) T()) : pointer_type();
+    }
+
+    template <typename A1>
+    static pointer_type generate(shm_segment &seg, A1 const &a1)
+    {
+        void *mem = seg.allocate(sizeof(T));
+        return mem ? wrap(seg, new (mem) T(a1)) : pointer_type();
+    }
+
+    template <typename A1, typename A2>
+    static pointer_type generate(shm_segment &seg, A1 const &a1, A2 const &a2)
+    {
+        void *mem = seg.allocate(sizeof(T));
+        return mem ? wrap(seg, new (mem) T(a1, a2)) : pointer_type();
+    }
+
+    template <typename A1, typename A2, typename A3>
+    static pointer_type generate(shm_segment &seg, A1 const &a1, A2 const &a2, A3 const &a3)
+    {
+        void *mem = seg.allocate(sizeof(T));
+        return mem ? wrap(seg, new (mem) T(a1, a2, a3)) : pointer_type();
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4>
+    static pointer_type generate(shm_segment &seg, A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4)
+    {
+        void *mem = seg.allocate(sizeof(T));
+        return mem ? wrap(seg, new (mem) T(a1, a2, a3, a4)) : pointer_type();
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4, typename A5>
+    static pointer_type generate(shm_segment &seg, A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5)
+    {
+        void *mem = seg.allocate(sizeof(T));
+        return mem ? wrap(seg, new (mem) T(a1, a2, a3, a4, a5)) : pointer_type();
+    }
+
+    template <typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
+    static pointer_type generate(shm_segment &seg, A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5, A6 const &a6)
+    {
+        void *mem = seg.allocate(sizeof(T));
+        return mem ? wrap(seg, new (mem) T(a1, a2, a3, a4, a5, a6)) : pointer_type();
+    }
+
+private:
+    static pointer_type wrap(shm_segment &seg, T *p)
+    {
+        pointer_type sp;
+        void *mem = seg.allocate(sizeof(shm_ref_count));
+        if (!mem) {
+            shm_mem_mgr<T>::deallocate(p);
+            return sp;
+        }
+        sp.attach(p, new (mem) shm_ref_count);
+        return sp;
+    }
+};
+
+}; // namespace smart_ptr
+
+
+#endif // __SHM_PTR_H__
@@ -24,55 +24,635 @@
 #ifndef __SMART_PTR_H__
 #define __SMART_PTR_H__
 
+#include <stddef.h>
+#include <limits.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif  // defined(_MSC_VER)
+
+#ifndef SMART_PTR_HAS_RVALUE_REFS
+#if (defined(__cplusplus) && __cplusplus >= 201103L) || (defined(_MSC_VER) && _MSC_VER >= 1600)
+#define SMART_PTR_HAS_RVALUE_REFS 1
+#endif
+#endif  // SMART_PTR_HAS_RVALUE_REFS
+
+// constexpr constructors where the compiler has them, so that immortal
+// pointers are set up by constant initialization
+#ifndef SMART_PTR_CONSTEXPR
+#if (defined(__cplusplus) && __cplusplus >= 201103L) || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#define SMART_PTR_CONSTEXPR constexpr
+#else
+#define SMART_PTR_CONSTEXPR
+#endif
+#endif  // SMART_PTR_CONSTEXPR
+
+// per-thread reuse of counter blocks, needs thread_local and std::atomic
+#ifndef SMART_PTR_BLOCK_CACHE
+#if (defined(__cplusplus) && __cplusplus >= 201103L) || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#define SMART_PTR_BLOCK_CACHE 1
+#else
+#define SMART_PTR_BLOCK_CACHE 0
+#endif
+#endif  // SMART_PTR_BLOCK_CACHE
+
+#if SMART_PTR_BLOCK_CACHE
+#include <atomic>
+#endif  // SMART_PTR_BLOCK_CACHE
+
+// debug builds count live strong_refs in the counter block and complain
+// when the last strong_ptr goes away while one of them still exists
+#ifndef SMART_PTR_CHECK_BORROWS
+#if defined(_DEBUG)
+#define SMART_PTR_CHECK_BORROWS 1
+#else
+#define SMART_PTR_CHECK_BORROWS 0
+#endif
+#endif  // SMART_PTR_CHECK_BORROWS
+
+#if SMART_PTR_CHECK_BORROWS
+#include <stdlib.h>
+#ifndef SMART_PTR_BORROW_VIOLATION
+#define SMART_PTR_BORROW_VIOLATION() abort()
+#endif  // SMART_PTR_BORROW_VIOLATION
+#endif  // SMART_PTR_CHECK_BORROWS
+
 namespace smart_ptr {
 
-class ref_count
+//////////////////////////////////////////////////////////////////////////
+// threading models used by the reference counter
+//
+
+// plain integer arithmetic, the caller is responsible for locking
+class single_thread_model
+{
+public:
+    // storage for a count held in an integer
+    template <typename integer>
+    struct counter
+    {
+        typedef integer type;
+    };
+
+    template <typename integer> static integer increment(integer &v) { return ++v; }
+    template <typename integer> static integer decrement(integer &v) { return (v > 0) ? --v : 0; }
+    template <typename integer> static integer add(integer &v, integer n) { return v += n; }
+    template <typename integer> static integer load(const integer &v) { return v; }
+    template <typename integer> static void store(integer &v, integer n) { v = n; }
+
+    template <typename integer>
+    static bool compare_exchange(integer &v, integer expected, integer desired)
+    {
+        if (v != expected) {
+            return false;
+        }
+        v = desired;
+        return true;
+    }
+};
+
+#if defined(_MSC_VER)
+// interlocked intrinsics by operand size
+template <size_t bytes> struct interlocked;
+
+template <> struct interlocked<2>
+{
+    typedef short type;
+    static type exchange_add(volatile type *v, type n) { return _InterlockedExchangeAdd16(v, n); }
+    static type compare_exchange(volatile type *v, type desired, type expected) { return _InterlockedCompareExchange16(v, desired, expected); }
+};
+
+template <> struct interlocked<4>
+{
+    typedef long type;
+    static type exchange_add(volatile type *v, type n) { return _InterlockedExchangeAdd(v, n); }
+    static type compare_exchange(volatile type *v, type desired, type expected) { return _InterlockedCompareExchange(v, desired, expected); }
+};
+
+template <> struct interlocked<8>
+{
+    typedef __int64 type;
+    static type exchange_add(volatile type *v, type n) { return _InterlockedExchangeAdd64(v, n); }
+    static type compare_exchange(volatile type *v, type desired, type expected) { return _InterlockedCompareExchange64(v, desired, expected); }
+};
+#endif  // defined(_MSC_VER)
+
+// interlocked arithmetic, pointers sharing one object may live on different threads
+class multi_thread_model
+{
+public:
+    template <typename integer>
+    struct counter
+    {
+        typedef volatile integer type;
+    };
+
+#if defined(_MSC_VER)
+    template <typename integer> static integer increment(volatile integer &v) { return add(v, (integer)1); }
+    template <typename integer> static integer decrement(volatile integer &v) { return add(v, (integer)-1); }
+    template <typename integer> static integer load(const volatile integer &v) { return v; }
+    template <typename integer> static void store(volatile integer &v, integer n) { v = n; }
+
+    template <typename integer>
+    static integer add(volatile integer &v, integer n)
+    {
+        typedef interlocked<sizeof(integer)> ops;
+        return (integer)(ops::exchange_add((volatile typename ops::type *)&v, (typename ops::type)n) + n);
+    }
+
+    template <typename integer>
+    static bool compare_exchange(volatile integer &v, integer expected, integer desired)
+    {
+        typedef interlocked<sizeof(integer)> ops;
+        return (typename ops::type)expected == ops::compare_exchange((volatile typename ops::type *)&v,
+            (typename ops::type)desired, (typename ops::type)expected);
+    }
+#else
+    template <typename integer> static integer increment(volatile integer &v) { return __atomic_add_fetch(&v, 1, __ATOMIC_RELAXED); }
+    template <typename integer> static integer decrement(volatile integer &v) { return __atomic_sub_fetch(&v, 1, __ATOMIC_ACQ_REL); }
+    template <typename integer> static integer add(volatile integer &v, integer n) { return __atomic_add_fetch(&v, n, __ATOMIC_ACQ_REL); }
+    template <typename integer> static integer load(const volatile integer &v) { return __atomic_load_n(&v, __ATOMIC_ACQUIRE); }
+    template <typename integer> static void store(volatile integer &v, integer n) { __atomic_store_n(&v, n, __ATOMIC_RELEASE); }
+
+    template <typename integer>
+    static bool compare_exchange(volatile integer &v, integer expected, integer desired)
+    {
+        return __atomic_compare_exchange_n(&v, &expected, desired, false,
+            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+#endif  // defined(_MSC_VER)
+};
+
+#ifndef SMART_PTR_DEFAULT_THREADING
+#define SMART_PTR_DEFAULT_THREADING single_thread_model
+#endif  // SMART_PTR_DEFAULT_THREADING
+
+#ifndef SMART_PTR_CACHE_LINE_SIZE
+#define SMART_PTR_CACHE_LINE_SIZE 64
+#endif  // SMART_PTR_CACHE_LINE_SIZE
+
+//////////////////////////////////////////////////////////////////////////
+// counter block layouts, chosen per pointee type through ref_count_layout
+//
+
+// both counts side by side, 8 bytes from the general heap
+struct compact_layout {};
+// the block owns a whole cache line, copies of one hot object do not slow
+// down pointers to the objects allocated next to it
+struct cache_line_layout {};
+// strong and weak counts on lines of their own as well, for objects whose
+// weak_ptrs are copied as much as their strong_ptrs
+struct split_layout {};
+// both counts in one word of twice the count width, so reading or changing
+// them together is one operation: the last owner of an object no weak_ptr
+// watches releases the block with a single update. The counts always
+// saturate, an overflowing strong count would run into the weak one.
+struct packed_layout {};
+
+// specialize to give the counter blocks of a type another layout:
+//     template <> struct ref_count_layout<Hot> { typedef cache_line_layout type; };
+// pointers converted into each other must agree on it
+template <class T>
+struct ref_count_layout
+{
+    typedef compact_layout type;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// count widths, chosen per pointee type through ref_count_width
+//
+
+// Counts are kept in an integer, by default an int that silently wraps
+// after 2^31 references. A sticky width saturates instead: once a count
+// passes half of its range it is set to three quarters and never changes
+// again, the object becomes immortal (leaked, never freed early) and its
+// pointers no longer write to the counter block at all. The margins leave
+// room for the updates of threads that raced with the saturation.
+template <typename integer, bool saturating=false>
+struct count_width
+{
+    typedef integer value_type;
+    enum { sticky = saturating };
+
+    static integer max_count()
+    {
+        return (integer)(~0ULL >> (64 - sizeof(integer) * 8 + 1));
+    }
+
+    static bool saturated(integer count)
+    {
+        return count > max_count() / 2;
+    }
+
+    static integer stuck_count()
+    {
+        return max_count() - max_count() / 4;
+    }
+
+    // counts are reported as int
+    static int clamp(integer count)
+    {
+        return (sizeof(integer) > sizeof(int) && count > (integer)INT_MAX) ? INT_MAX : (int)count;
+    }
+};
+
+typedef count_width<int> default_counts;
+// 64-bit counts do not wrap in practice
+typedef count_width<long long> wide_counts;
+typedef count_width<int, true> saturating_counts;
+// for small objects, two 16-bit counts that saturate
+typedef count_width<short, true> small_counts;
+
+// specialize to give the counter blocks of a type another count width:
+//     template <> struct ref_count_width<Node> { typedef small_counts type; };
+template <class T>
+struct ref_count_width
+{
+    typedef default_counts type;
+};
+
+// unsigned word holding two counts of the given size
+template <size_t bytes> struct packed_count_word;
+template <> struct packed_count_word<2> { typedef unsigned int type; };
+template <> struct packed_count_word<4> { typedef unsigned long long type; };
+
+// operator new/delete handing out cache line aligned memory
+class cache_line_aligned
+{
+public:
+    static void * operator new(size_t size)
+    {
+        char *raw = (char *)::operator new(size + SMART_PTR_CACHE_LINE_SIZE);
+        char *p = (char *)(((size_t)raw + SMART_PTR_CACHE_LINE_SIZE) & ~(size_t)(SMART_PTR_CACHE_LINE_SIZE - 1));
+        ((char **)p)[-1] = raw;
+        return p;
+    }
+
+    static void operator delete(void *p)
+    {
+        if (p) {
+            ::operator delete(((char **)p)[-1]);
+        }
+    }
+};
+
+#if SMART_PTR_BLOCK_CACHE
+
+#ifndef SMART_PTR_BLOCK_CACHE_SIZE
+#define SMART_PTR_BLOCK_CACHE_SIZE 64
+#endif  // SMART_PTR_BLOCK_CACHE_SIZE
+
+// A thread keeps up to SMART_PTR_BLOCK_CACHE_SIZE freed counter blocks and
+// reuses them for its next allocations. When the list is full, half of it
+// goes to a global depot as one batch, and a thread with an empty list takes
+// a batch from there before asking the heap, so blocks freed on a consumer
+// thread come back to the producer that allocates them. Depot slots are
+// taken with an exchange, which leaves no room for ABA.
+class counter_block_cache
+{
+public:
+    enum { block_size = 16 };
+
+    static void * allocate()
+    {
+        local_list &l = local();
+        if (!l.head && !l.closed) {
+            refill(l);
+        }
+        if (l.head) {
+            block *b = l.head;
+            l.head = b->next;
+            --l.count;
+            return b;
+        }
+        return ::operator new(block_size);
+    }
+
+    static void deallocate(void *p)
+    {
+        local_list &l = local();
+        if (l.closed) {
+            ::operator delete(p);
+            return;
+        }
+        register_owner(l);
+        if (l.count == SMART_PTR_BLOCK_CACHE_SIZE) {
+            spill(l);
+        }
+        block *b = (block *)p;
+        b->next = l.head;
+        l.head = b;
+        ++l.count;
+    }
+
+private:
+    enum {
+        batch_size = SMART_PTR_BLOCK_CACHE_SIZE / 2,
+        depot_slots = 64
+    };
+
+    struct block
+    {
+        block *next;
+    };
+
+    // trivially destructible, so it stays usable while other thread_local
+    // destructors still free blocks; those go to the heap once closed
+    struct local_list
+    {
+        block *head;
+        size_t count;
+        bool registered;
+        bool closed;
+    };
+
+    struct local_owner
+    {
+        ~local_owner()
+        {
+            local_list &l = local();
+            l.closed = true;
+            while (l.head) {
+                block *b = l.head;
+                l.head = b->next;
+                ::operator delete(b);
+            }
+            l.count = 0;
+        }
+    };
+
+    static local_list & local()
+    {
+        static thread_local local_list l;
+        return l;
+    }
+
+    static local_owner & owner()
+    {
+        static thread_local local_owner o;
+        return o;
+    }
+
+    // the blocks held by a thread are freed when it exits
+    static void register_owner(local_list &l)
+    {
+        if (!l.registered) {
+            l.registered = true;
+            owner();
+        }
+    }
+
+    static std::atomic<block *> * depot()
+    {
+        static std::atomic<block *> slots[depot_slots];
+        return slots;
+    }
+
+    // move the first batch_size blocks of the list to the depot
+    static void spill(local_list &l)
+    {
+        block *first = l.head;
+        block *last = first;
+        for (size_t i = 1; i < batch_size; ++i) {
+            last = last->next;
+        }
+        l.head = last->next;
+        l.count -= batch_size;
+        last->next = 0;
+
+        std::atomic<block *> *slots = depot();
+        for (size_t i = 0; i < depot_slots; ++i) {
+            block *expected = 0;
+            if (!slots[i].load(std::memory_order_relaxed)
+                && slots[i].compare_exchange_strong(expected, first, std::memory_order_release)) {
+                return;
+            }
+        }
+        while (first) {
+            block *b = first;
+            first = b->next;
+            ::operator delete(b);
+        }
+    }
+
+    static void refill(local_list &l)
+    {
+        std::atomic<block *> *slots = depot();
+        for (size_t i = 0; i < depot_slots; ++i) {
+            if (slots[i].load(std::memory_order_relaxed)) {
+                block *batch = slots[i].exchange(0, std::memory_order_acquire);
+                if (batch) {
+                    register_owner(l);
+                    l.head = batch;
+                    l.count = batch_size;
+                    return;
+                }
+            }
+        }
+    }
+};
+
+// counter blocks small enough for the cache are taken from it
+class cached_block
 {
 public:
-    ref_count() : m_strong_ref_count(1), m_weak_ref_count(0)
+    static void * operator new(size_t size)
+    {
+        return size <= counter_block_cache::block_size
+            ? counter_block_cache::allocate() : ::operator new(size);
+    }
+
+    static void operator delete(void *p, size_t size)
     {
+        if (!p) {
+            return;
+        }
+        if (size <= counter_block_cache::block_size) {
+            counter_block_cache::deallocate(p);
+        } else {
+            ::operator delete(p);
+        }
     }
+};
+
+#else
+class cached_block {};
+#endif  // SMART_PTR_BLOCK_CACHE
+
+template <typename threading_model, typename layout, typename width>
+class ref_count_storage : public cached_block
+{
+protected:
+    typedef typename threading_model::template counter<typename width::value_type>::type count_type;
 
-    ~ref_count()
+    SMART_PTR_CONSTEXPR ref_count_storage() : m_strong_ref_count(1), m_weak_ref_count(1)
+#if SMART_PTR_CHECK_BORROWS
+        , m_borrow_count(0)
+#endif  // SMART_PTR_CHECK_BORROWS
     {
     }
 
+    count_type m_strong_ref_count;
+    count_type m_weak_ref_count;
+#if SMART_PTR_CHECK_BORROWS
+    count_type m_borrow_count;
+#endif  // SMART_PTR_CHECK_BORROWS
+};
+
+template <typename threading_model, typename width>
+class ref_count_storage<threading_model, cache_line_layout, width> : public cache_line_aligned
+{
+protected:
+    typedef typename threading_model::template counter<typename width::value_type>::type count_type;
+
+    SMART_PTR_CONSTEXPR ref_count_storage() : m_strong_ref_count(1), m_weak_ref_count(1)
+#if SMART_PTR_CHECK_BORROWS
+        , m_borrow_count(0)
+#endif  // SMART_PTR_CHECK_BORROWS
+        , m_pad()
+    {
+    }
+
+    count_type m_strong_ref_count;
+    count_type m_weak_ref_count;
+#if SMART_PTR_CHECK_BORROWS
+    count_type m_borrow_count;
+#endif  // SMART_PTR_CHECK_BORROWS
+    char m_pad[SMART_PTR_CACHE_LINE_SIZE - (2 + SMART_PTR_CHECK_BORROWS) * sizeof(count_type)];
+};
+
+template <typename threading_model, typename width>
+class ref_count_storage<threading_model, split_layout, width> : public cache_line_aligned
+{
+protected:
+    typedef typename threading_model::template counter<typename width::value_type>::type count_type;
+
+    SMART_PTR_CONSTEXPR ref_count_storage() : m_strong_ref_count(1), m_pad1(), m_weak_ref_count(1)
+#if SMART_PTR_CHECK_BORROWS
+        , m_borrow_count(0)
+#endif  // SMART_PTR_CHECK_BORROWS
+        , m_pad2()
+    {
+    }
+
+    count_type m_strong_ref_count;
+    char m_pad1[SMART_PTR_CACHE_LINE_SIZE - sizeof(count_type)];
+    count_type m_weak_ref_count;
+#if SMART_PTR_CHECK_BORROWS
+    count_type m_borrow_count;
+#endif  // SMART_PTR_CHECK_BORROWS
+    char m_pad2[SMART_PTR_CACHE_LINE_SIZE - (1 + SMART_PTR_CHECK_BORROWS) * sizeof(count_type)];
+};
+
+// strong count in the low half of the word, weak count in the high half
+template <typename threading_model, typename width>
+class ref_count_storage<threading_model, packed_layout, width> : public cached_block
+{
+protected:
+    typedef typename packed_count_word<sizeof(typename width::value_type)>::type word_type;
+    typedef typename threading_model::template counter<word_type>::type count_type;
+
+    SMART_PTR_CONSTEXPR ref_count_storage() : m_counts(((word_type)1 << (sizeof(typename width::value_type) * 8)) | 1)
+#if SMART_PTR_CHECK_BORROWS
+        , m_borrow_count(0)
+#endif  // SMART_PTR_CHECK_BORROWS
+    {
+    }
+
+    count_type m_counts;
+#if SMART_PTR_CHECK_BORROWS
+    typename threading_model::template counter<typename width::value_type>::type m_borrow_count;
+#endif  // SMART_PTR_CHECK_BORROWS
+};
+
+// The strong owners together hold one weak reference, so the counter block
+// is deleted by whoever drops the last weak reference, never by two threads.
+template <typename threading_model, typename layout=compact_layout, typename width=default_counts>
+class basic_ref_count : public ref_count_storage<threading_model, layout, width>
+{
+    typedef ref_count_storage<threading_model, layout, width> storage;
+    typedef typename storage::count_type count_type;
+    typedef typename width::value_type value_type;
+    using storage::m_strong_ref_count;
+    using storage::m_weak_ref_count;
+#if SMART_PTR_CHECK_BORROWS
+    using storage::m_borrow_count;
+#endif  // SMART_PTR_CHECK_BORROWS
+
+public:
+    SMART_PTR_CONSTEXPR basic_ref_count()
+    {
+    }
+
+    ~basic_ref_count()
+    {
+    }
+
+    // called by base_ptr right after creating the counter for a new object;
+    // a counter that has to free the object itself records how to do it here
+    template <class T, typename mem_mgr>
+    void bind(T *)
+    {
+    }
+
+    // called by base_ptr when the last strong reference goes, with the type
+    // and mem_mgr of the pointer that dropped it
+    template <class T, typename mem_mgr>
+    void destroy(T *p)
+    {
+        mem_mgr::deallocate(p);
+    }
+
     // increment use count
     int inc_ref()
     {
-        return ++m_strong_ref_count;
+        return count_up(m_strong_ref_count);
+    }
+
+    // increment use count unless it already dropped to 0, used by weak_ptr::lock
+    bool inc_ref_if_alive()
+    {
+        for (;;) {
+            value_type count = threading_model::load(m_strong_ref_count);
+            if (count == 0) {
+                return false;
+            }
+            if (width::sticky && width::saturated(count)) {
+                return true;
+            }
+            if (threading_model::compare_exchange(m_strong_ref_count, count, (value_type)(count + 1))) {
+                return true;
+            }
+        }
     }
 
     // increment weak reference count
     int inc_weak_ref()
     {
-        return ++m_weak_ref_count;
+        return count_up(m_weak_ref_count);
     }
 
     // decrement use count
     int dec_ref()
     {
-        int nRs = 0;
-        if (m_strong_ref_count > 0) {
-            nRs = --m_strong_ref_count;
+        int count = count_down(m_strong_ref_count);
+#if SMART_PTR_CHECK_BORROWS
+        if (count == 0 && threading_model::load(m_borrow_count) != 0) {
+            SMART_PTR_BORROW_VIOLATION();
         }
-        return nRs;
+#endif  // SMART_PTR_CHECK_BORROWS
+        return count;
     }
 
-    // decrement weak reference count
+    // decrement weak reference count, the block may be deleted when it returns 0
     int dec_weak_ref()
     {
-        int nRs = 0;
-        if (m_weak_ref_count > 0) {
-            nRs = --m_weak_ref_count;
-        }
-        return nRs;
+        return count_down(m_weak_ref_count);
     }
 
     // return use count
     int get_ref_count() const
     {
-        return m_strong_ref_count;
+        return width::clamp(threading_model::load(m_strong_ref_count));
     }
 
     // return true if _Uses == 0
@@ -81,15 +661,216 @@ public:
         return (get_ref_count() == 0);
     }
 
+    // return weak reference count, not including the one held by the strong owners
     int get_weak_ref_count() const
     {
-        return m_weak_ref_count;
+        int nRs = width::clamp(threading_model::load(m_weak_ref_count));
+        if (get_ref_count() > 0) {
+            --nRs;
+        }
+        return nRs;
     }
 
+#if SMART_PTR_CHECK_BORROWS
+    // strong_ref bookkeeping, debug builds only
+    void inc_borrow()           { threading_model::increment(m_borrow_count); }
+    void dec_borrow()           { threading_model::decrement(m_borrow_count); }
+    int get_borrow_count() const { return width::clamp(threading_model::load(m_borrow_count)); }
+#endif  // SMART_PTR_CHECK_BORROWS
+
 private:
-    int m_strong_ref_count;
-    int m_weak_ref_count;
-}; 
+    static int count_up(count_type &v)
+    {
+        if (!width::sticky) {
+            return width::clamp(threading_model::increment(v));
+        }
+        // a saturated count is only read, its line stays shared between cores
+        value_type count = threading_model::load(v);
+        if (!width::saturated(count)) {
+            count = threading_model::increment(v);
+            if (width::saturated(count)) {
+                threading_model::store(v, width::stuck_count());
+            }
+        }
+        return width::clamp(count);
+    }
+
+    static int count_down(count_type &v)
+    {
+        if (width::sticky) {
+            value_type count = threading_model::load(v);
+            if (width::saturated(count)) {
+                return width::clamp(count);
+            }
+        }
+        return width::clamp(threading_model::decrement(v));
+    }
+};
+
+template <typename threading_model, typename width>
+class basic_ref_count<threading_model, packed_layout, width> : public ref_count_storage<threading_model, packed_layout, width>
+{
+    typedef ref_count_storage<threading_model, packed_layout, width> storage;
+    typedef typename storage::word_type word_type;
+    typedef typename width::value_type value_type;
+    using storage::m_counts;
+#if SMART_PTR_CHECK_BORROWS
+    using storage::m_borrow_count;
+#endif  // SMART_PTR_CHECK_BORROWS
+
+    enum { count_bits = sizeof(value_type) * 8 };
+
+    static word_type weak_unit()                { return (word_type)1 << count_bits; }
+    static value_type strong_part(word_type w)  { return (value_type)(w & (weak_unit() - 1)); }
+    static value_type weak_part(word_type w)    { return (value_type)(w >> count_bits); }
+
+public:
+    SMART_PTR_CONSTEXPR basic_ref_count()
+    {
+    }
+
+    ~basic_ref_count()
+    {
+    }
+
+    template <class T, typename mem_mgr>
+    void bind(T *)
+    {
+    }
+
+    template <class T, typename mem_mgr>
+    void destroy(T *p)
+    {
+        mem_mgr::deallocate(p);
+    }
+
+    int inc_ref()
+    {
+        word_type w = threading_model::load(m_counts);
+        if (width::saturated(strong_part(w))) {
+            return width::clamp(strong_part(w));
+        }
+        w = threading_model::increment(m_counts);
+        if (width::saturated(strong_part(w))) {
+            stick(0, width::stuck_count());
+        }
+        return width::clamp(strong_part(w));
+    }
+
+    // strong and weak count are checked together, no second read
+    bool inc_ref_if_alive()
+    {
+        for (;;) {
+            word_type w = threading_model::load(m_counts);
+            value_type count = strong_part(w);
+            if (count == 0) {
+                return false;
+            }
+            if (width::saturated(count)) {
+                return true;
+            }
+            if (threading_model::compare_exchange(m_counts, w, (word_type)(w + 1))) {
+                return true;
+            }
+        }
+    }
+
+    int inc_weak_ref()
+    {
+        word_type w = threading_model::load(m_counts);
+        if (width::saturated(weak_part(w))) {
+            return width::clamp(weak_part(w));
+        }
+        w = threading_model::add(m_counts, weak_unit());
+        if (width::saturated(weak_part(w))) {
+            stick(1, width::stuck_count());
+        }
+        return width::clamp(weak_part(w));
+    }
+
+    int dec_ref()
+    {
+        word_type w = threading_model::load(m_counts);
+        int count;
+        if (width::saturated(strong_part(w))) {
+            return width::clamp(strong_part(w));
+        } else if (w == (weak_unit() | 1) && threading_model::compare_exchange(m_counts, w, (word_type)0)) {
+            // last owner and no weak_ptr: both counts dropped at once,
+            // dec_weak_ref() will find the block already released
+            count = 0;
+        } else {
+            count = width::clamp(strong_part(threading_model::decrement(m_counts)));
+        }
+#if SMART_PTR_CHECK_BORROWS
+        if (count == 0 && threading_model::load(m_borrow_count) != 0) {
+            SMART_PTR_BORROW_VIOLATION();
+        }
+#endif  // SMART_PTR_CHECK_BORROWS
+        return count;
+    }
+
+    int dec_weak_ref()
+    {
+        word_type w = threading_model::load(m_counts);
+        if (w == 0) {
+            return 0;
+        }
+        if (width::saturated(weak_part(w))) {
+            return width::clamp(weak_part(w));
+        }
+        return width::clamp(weak_part(threading_model::add(m_counts, (word_type)(0 - weak_unit()))));
+    }
+
+    int get_ref_count() const
+    {
+        return width::clamp(strong_part(threading_model::load(m_counts)));
+    }
+
+    bool expired() const
+    {
+        return (get_ref_count() == 0);
+    }
+
+    int get_weak_ref_count() const
+    {
+        word_type w = threading_model::load(m_counts);
+        int nRs = width::clamp(weak_part(w));
+        if (strong_part(w) > 0) {
+            --nRs;
+        }
+        return nRs;
+    }
+
+#if SMART_PTR_CHECK_BORROWS
+    void inc_borrow()           { threading_model::increment(m_borrow_count); }
+    void dec_borrow()           { threading_model::decrement(m_borrow_count); }
+    int get_borrow_count() const { return width::clamp(threading_model::load(m_borrow_count)); }
+#endif  // SMART_PTR_CHECK_BORROWS
+
+private:
+    // set one half of the word, keeping the other
+    void stick(int half, value_type count)
+    {
+        word_type mask = (word_type)(weak_unit() - 1) << (half * count_bits);
+        word_type part = (word_type)count << (half * count_bits);
+        for (;;) {
+            word_type w = threading_model::load(m_counts);
+            if (threading_model::compare_exchange(m_counts, w, (word_type)((w & ~mask) | part))) {
+                return;
+            }
+        }
+    }
+};
+
+typedef basic_ref_count<SMART_PTR_DEFAULT_THREADING> ref_count;
+typedef basic_ref_count<multi_thread_model> mt_ref_count;
+
+// counter for pointers to T: the given threading model, T's layout and count width
+template <class T, typename threading_model=SMART_PTR_DEFAULT_THREADING>
+struct ref_count_for
+{
+    typedef basic_ref_count<threading_model, typename ref_count_layout<T>::type, typename ref_count_width<T>::type> type;
+};
 
 #if defined(WIN32) || defined(_WIN32)
 template <class T> class _NoAddRefReleaseOnComPtr : public T {
@@ -99,33 +880,83 @@ private:
 };
 #endif  // defined(WIN32) || defined(_WIN32)
 
+//////////////////////////////////////////////////////////////////////////
+// immortal objects: statics and singletons handed out as strong_ptr
+//
+
+// tag for the strong_ptr constructor that makes an immortal pointer
+struct immortal_tag {};
+
+// Every immortal pointer with this kind of counter shares the one block,
+// set up by constant initialization (C++11) and never written: pointers
+// holding it skip all counting, copying one from many threads touches
+// nothing shared, and the object is never freed. The block does not tell
+// immortal objects apart, base_ptr::identity() does.
+template <class ref_counter>
+struct immortal_block
+{
+    static ref_counter block;
+};
+
+template <class ref_counter>
+ref_counter immortal_block<ref_counter>::block;
+
+template <class ref_counter>
+inline bool is_immortal(const ref_counter *counter)
+{
+    return counter == &immortal_block<ref_counter>::block;
+}
+
 // base class for strong_ptr and weak_ptr
-template<class T, bool is_strong, typename mem_mgr>
+template<class T, bool is_strong, typename mem_mgr, typename ref_counter=typename ref_count_for<T>::type>
 class base_ptr
 {
 public:
-    explicit base_ptr(T *p=0) : m_counter(0), m_ptr(p)
+    // kept apart from the T* constructor, so that pointers are usable with
+    // counters that can only be created in place (shm_ref_count)
+    base_ptr() : m_counter(0), m_ptr(0)
+    {
+    }
+
+    explicit base_ptr(T *p) : m_counter(0), m_ptr(p)
     {
         if (m_ptr) {
             if (is_strong) {
                 // allocate a new ref_count
-                m_counter = new ref_count;
+                m_counter = new ref_counter;
+                m_counter->template bind<T, mem_mgr>(m_ptr);
             }
         }
     }
 
+    // immortal pointer to p, see immortal_block
+    SMART_PTR_CONSTEXPR base_ptr(T *p, immortal_tag)
+        : m_counter(&immortal_block<ref_counter>::block), m_ptr(p)
+    {
+    }
+
     base_ptr(const base_ptr& rhs) : m_counter(0), m_ptr(0)
     {
         acquire(rhs);
     }
 
     template<class Q, bool b, typename mem_mgr2> 
-    base_ptr(const base_ptr<Q, b, mem_mgr2> &rhs) : m_counter(0), m_ptr(0)
+    base_ptr(const base_ptr<Q, b, mem_mgr2, ref_counter> &rhs) : m_counter(0), m_ptr(0)
     {
         acquire(rhs);
     }
 
-    virtual ~base_ptr()
+#if SMART_PTR_HAS_RVALUE_REFS
+    base_ptr(base_ptr &&rhs) : m_counter(rhs.m_counter), m_ptr(rhs.m_ptr)
+    {
+        rhs.m_counter = 0;
+        rhs.m_ptr = 0;
+    }
+#endif  // SMART_PTR_HAS_RVALUE_REFS
+
+    // not virtual: pointers are never deleted through base_ptr, and without
+    // a vptr a strong_ptr is two words
+    ~base_ptr()
     {
         release();
     }
@@ -139,17 +970,35 @@ public:
 #endif  // defined(WIN32) || defined(_WIN32)
     T* get()        const throw()   { return m_ptr; }
 
+    // counter block of the owned object, every pointer to one object shares it
+    ref_counter * get_counter() const throw() { return m_counter; }
+
+    // what tells owned objects apart: the counter block, or for immortal
+    // pointers, which all share one block, the object itself
+    const void * identity() const throw()
+    { return is_immortal(m_counter) ? static_cast<const void *>(m_ptr) : static_cast<const void *>(m_counter); }
+
     bool unique() const throw()
-    { return (m_counter ? (1 == m_counter->get_ref_count()) : true); }
+    { return (m_counter ? (1 == use_count()) : true); }
+
+    // true if the object is never freed
+    bool immortal() const throw()
+    { return is_immortal(m_counter); }
+
+    void reset()
+    {
+        base_ptr<T, is_strong, mem_mgr, ref_counter> ptr;
+        reset(ptr);
+    }
 
-    void reset(T *p=0)
+    void reset(T *p)
     {
-        base_ptr<T, is_strong, mem_mgr> ptr(p);
+        base_ptr<T, is_strong, mem_mgr, ref_counter> ptr(p);
         reset(ptr);
     }
 
     template <class Q, bool b, typename mem_mgr2> 
-    void reset(const base_ptr<Q, b, mem_mgr2> &rhs)
+    void reset(const base_ptr<Q, b, mem_mgr2, ref_counter> &rhs)
     {
         if ((void *)this != (void *)&rhs) {
             release();
@@ -160,7 +1009,9 @@ public:
     int use_count(void) const
     {
         int nRs = 0;
-        if (m_counter) {
+        if (is_immortal(m_counter)) {
+            nRs = INT_MAX;
+        } else if (m_counter) {
             nRs = m_counter->get_ref_count();
         }
         return nRs;
@@ -168,12 +1019,31 @@ public:
 
     // swap pointers
     template <class Q, bool b, typename mem_mgr2>
-    void swap(base_ptr<Q, b, mem_mgr2> & rhs)
+    void swap(base_ptr<Q, b, mem_mgr2, ref_counter> & rhs)
     {
         private_swap(m_counter, rhs.m_counter);
         private_swap(m_ptr, rhs.m_ptr);
     }
 
+    // give up the owned reference as raw parts without touching the counts,
+    // the caller must hand both back to attach() of the same kind of pointer
+    T * detach(ref_counter *&counter) throw()
+    {
+        T *p = m_ptr;
+        counter = m_counter;
+        m_ptr = 0;
+        m_counter = 0;
+        return p;
+    }
+
+    // take over a reference given up by detach(), the counts are not touched
+    void attach(T *p, ref_counter *counter) throw()
+    {
+        release();
+        m_ptr = p;
+        m_counter = counter;
+    }
+
     base_ptr& operator=(const base_ptr &rhs)
     {
         reset(rhs);
@@ -181,14 +1051,14 @@ public:
     }
 
     template <class Q, bool b, typename mem_mgr2>
-    base_ptr& operator=(const base_ptr<Q, b, mem_mgr2> &rhs)
+    base_ptr& operator=(const base_ptr<Q, b, mem_mgr2, ref_counter> &rhs)
     {
         reset(rhs);
         return *this;
     }
 
 protected:
-    ref_count *m_counter;
+    ref_counter *m_counter;
     T * m_ptr;
 
     template <typename TP1, typename TP2>
@@ -200,32 +1070,45 @@ protected:
     }
 
     template <class Q, bool b, typename mem_mgr2>
-    void acquire(const base_ptr<Q, b, mem_mgr2> & rhs) throw()
+    void acquire(const base_ptr<Q, b, mem_mgr2, ref_counter> & rhs) throw()
     {
-        if (rhs.m_counter && rhs.m_counter->get_ref_count()) {
-            m_counter = rhs.m_counter;
-            if (is_strong) {
-                m_counter->inc_ref();
-            } else {
-                m_counter->inc_weak_ref();
+        ref_counter *counter = rhs.m_counter;
+        if (counter == 0) {
+            return;
+        }
+        if (is_immortal(counter)) {
+            // nothing to count
+        } else if (is_strong) {
+            if (b) {
+                counter->inc_ref();
+            } else if (!counter->inc_ref_if_alive()) {
+                return;
+            }
+        } else {
+            if (counter->expired()) {
+                return;
             }
-            m_ptr = static_cast<T*>(rhs.m_ptr);
+            counter->inc_weak_ref();
         }
+        m_counter = counter;
+        m_ptr = static_cast<T*>(rhs.m_ptr);
     }
 
     // decrement the count, delete if it is 0
     void release(void)
     {
         if (m_counter) {
-            if (is_strong) {
+            if (is_immortal(m_counter)) {
+                // never freed
+            } else if (is_strong) {
                 if (0 == m_counter->dec_ref()) {
-                    mem_mgr::deallocate(m_ptr);
-                    m_ptr = 0;
+                    m_counter->template destroy<T, mem_mgr>(m_ptr);
+                    // drop the weak reference held by the strong owners
+                    if (0 == m_counter->dec_weak_ref()) {
+                        delete m_counter;
+                    }
                 }
-            } else {
-                m_counter->dec_weak_ref();
-            }
-            if (0 == m_counter->get_ref_count() && 0==m_counter->get_weak_ref_count()) {
+            } else if (0 == m_counter->dec_weak_ref()) {
                 delete m_counter;
             }
             m_counter = 0;
@@ -235,17 +1118,17 @@ protected:
         }
     }
 
-    template<class Q, bool b, typename mem_mgr2> friend class base_ptr;
+    template<class Q, bool b, typename mem_mgr2, typename ref_counter2> friend class base_ptr;
 };
 
-template<class T, bool bx, class Q, bool by, typename mem_mgr1, typename mem_mgr2>
-bool operator<(const base_ptr<T, bx, mem_mgr1> &lhs, const base_ptr<Q, by, mem_mgr2> &rhs)
+template<class T, bool bx, class Q, bool by, typename mem_mgr1, typename mem_mgr2, typename ref_counter>
+bool operator<(const base_ptr<T, bx, mem_mgr1, ref_counter> &lhs, const base_ptr<Q, by, mem_mgr2, ref_counter> &rhs)
 {
     // test if left pointer < right pointer
     return lhs.get() < rhs.get();
 }
 
-template <class T, typename mem_mgr> class weak_ptr;
+template <class T, typename mem_mgr, typename ref_counter> class weak_ptr;
 
 template<typename T>
 class std_mem_mgr {
@@ -260,12 +1143,24 @@ public:
     template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6> static T * allocate(A1 const &a1, A2 const &a2, A3 const &a3, A4 const &a4, A5 const &a5, A6 const &a6) { return new T(a1, a2, a3, a4, a5, a6); }
 };
 
-template <class T, typename mem_mgr=std_mem_mgr<T> >
-class strong_ptr : public base_ptr<T, true, mem_mgr>
+template <class T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=typename ref_count_for<T>::type>
+class strong_ptr : public base_ptr<T, true, mem_mgr, ref_counter>
 {
-    typedef base_ptr<T, true, mem_mgr> baseClass;
+    typedef base_ptr<T, true, mem_mgr, ref_counter> baseClass;
 public:
-    explicit strong_ptr(T* p = 0) : baseClass(p)
+    strong_ptr()
+    {
+    }
+
+    explicit strong_ptr(T* p) : baseClass(p)
+    {
+    }
+
+    // a pointer to *p that is never counted and never frees it, usable in
+    // constant initialization of globals:
+    //     static Config Default_config_object;
+    //     static const ConfigPtr Default_config(immortal_tag(), &Default_config_object);
+    SMART_PTR_CONSTEXPR strong_ptr(immortal_tag tag, T *p) : baseClass(p, tag)
     {
     }
 
@@ -273,14 +1168,30 @@ public:
     {
     }
 
+#if SMART_PTR_HAS_RVALUE_REFS
+    strong_ptr(strong_ptr &&rhs) : baseClass(static_cast<baseClass &&>(rhs))
+    {
+    }
+
+    strong_ptr& operator=(strong_ptr &&rhs)
+    {
+        if (this != &rhs) {
+            ref_counter *counter;
+            T *p = rhs.detach(counter);
+            this->attach(p, counter);
+        }
+        return *this;
+    }
+#endif  // SMART_PTR_HAS_RVALUE_REFS
+
     template<class Q, typename mem_mgr2> 
-    strong_ptr(const strong_ptr<Q, mem_mgr2> &rhs) : baseClass(rhs)
+    strong_ptr(const strong_ptr<Q, mem_mgr2, ref_counter> &rhs) : baseClass(rhs)
     {
     }
 
     // construct strong_ptr object that owns resource *rhs
     template<class Q, typename mem_mgr2> 
-    explicit strong_ptr(const weak_ptr<Q, mem_mgr2> &rhs) : baseClass(rhs)
+    explicit strong_ptr(const weak_ptr<Q, mem_mgr2, ref_counter> &rhs) : baseClass(rhs)
     {
     }
 
@@ -295,14 +1206,14 @@ public:
     }
 
     template <class Q, typename mem_mgr2> 
-    strong_ptr& operator=(const strong_ptr<Q, mem_mgr2> &rhs)
+    strong_ptr& operator=(const strong_ptr<Q, mem_mgr2, ref_counter> &rhs)
     {
         baseClass::operator = (rhs);
         return *this;
     }
 
     template <class Q, typename mem_mgr2>
-    strong_ptr& operator=(const weak_ptr<Q, mem_mgr2> &rhs)
+    strong_ptr& operator=(const weak_ptr<Q, mem_mgr2, ref_counter> &rhs)
     {
         baseClass::operator = (rhs);
         return *this;
@@ -310,10 +1221,10 @@ public:
 };
 
 
-template <class T, typename mem_mgr=std_mem_mgr<T> >
-class weak_ptr : public base_ptr<T, false, mem_mgr>
+template <class T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=typename ref_count_for<T>::type>
+class weak_ptr : public base_ptr<T, false, mem_mgr, ref_counter>
 {
-    typedef base_ptr<T, false, mem_mgr> baseClass;
+    typedef base_ptr<T, false, mem_mgr, ref_counter> baseClass;
 public:
     // construct empty weak_ptr object
     weak_ptr()
@@ -322,7 +1233,7 @@ public:
 
     // construct weak_ptr object for resource owned by rhs
     template<class Q, typename mem_mgr2>
-    weak_ptr(const strong_ptr<Q, mem_mgr2> &rhs) : baseClass(rhs)
+    weak_ptr(const strong_ptr<Q, mem_mgr2, ref_counter> &rhs) : baseClass(rhs)
     {
     }
 
@@ -333,7 +1244,7 @@ public:
 
     // construct weak_ptr object for resource pointed to by rhs
     template<class Q, typename mem_mgr2>
-    weak_ptr(const weak_ptr<Q, mem_mgr2> &rhs) : baseClass(rhs)
+    weak_ptr(const weak_ptr<Q, mem_mgr2, ref_counter> &rhs) : baseClass(rhs)
     {
     }
 
@@ -348,14 +1259,14 @@ public:
     }
 
     template <class Q, typename mem_mgr2>
-    weak_ptr& operator=(const weak_ptr<Q, mem_mgr2> &rhs)
+    weak_ptr& operator=(const weak_ptr<Q, mem_mgr2, ref_counter> &rhs)
     {
         baseClass::operator = (rhs);
         return *this;
     }
 
     template <class Q, typename mem_mgr2>
-    weak_ptr& operator=(const strong_ptr<Q, mem_mgr2> &rhs)
+    weak_ptr& operator=(const strong_ptr<Q, mem_mgr2, ref_counter> &rhs)
     {
         baseClass::operator = (rhs);
         return *this;
@@ -364,13 +1275,13 @@ public:
     // return true if resource no longer exists
     bool expired() const
     {
-        return m_counter ? m_counter->expired() : true;
+        return this->m_counter ? this->m_counter->expired() : true;
     }
 
     // convert to strong_ptr
-    strong_ptr<T, mem_mgr> lock() const
+    strong_ptr<T, mem_mgr, ref_counter> lock() const
     {
-        return strong_ptr<T, mem_mgr>(*this);
+        return strong_ptr<T, mem_mgr, ref_counter>(*this);
     }
 
 private:
@@ -381,16 +1292,102 @@ private:
 };
 
 
+//////////////////////////////////////////////////////////////////////////
+//
+//   strong_ref: a borrowed reference to an object some strong_ptr owns.
+//   Forming and copying one does not touch the counts, so it is the
+//   cheap way to hand an object down a call chain; the caller has to keep
+//   an owning strong_ptr alive until the borrow is gone. Debug builds
+//   (SMART_PTR_CHECK_BORROWS) count borrows in the counter block and stop
+//   on SMART_PTR_BORROW_VIOLATION() if the last owner goes away first.
+//   promote() turns a borrow back into a strong_ptr with one increment.
+//
+
+template <class T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=typename ref_count_for<T>::type>
+class strong_ref
+{
+public:
+    typedef strong_ptr<T, mem_mgr, ref_counter> pointer_type;
+
+    template <class Q, typename mem_mgr2>
+    strong_ref(const strong_ptr<Q, mem_mgr2, ref_counter> &owner)
+        : m_ptr(owner.get()), m_counter(owner.get_counter())
+    {
+        borrow();
+    }
+
+    template <class Q, typename mem_mgr2>
+    strong_ref(const strong_ref<Q, mem_mgr2, ref_counter> &rhs)
+        : m_ptr(rhs.get()), m_counter(rhs.get_counter())
+    {
+        borrow();
+    }
+
+#if SMART_PTR_CHECK_BORROWS
+    strong_ref(const strong_ref &rhs) : m_ptr(rhs.m_ptr), m_counter(rhs.m_counter)
+    {
+        borrow();
+    }
+
+    ~strong_ref()
+    {
+        if (m_counter && !is_immortal(m_counter)) {
+            m_counter->dec_borrow();
+        }
+    }
+#endif  // SMART_PTR_CHECK_BORROWS
+    // otherwise the implicit copy and destructor keep it trivially
+    // copyable, passed in registers like a raw pointer
+
+    T* get()        const   { return m_ptr; }
+    T* operator->() const   { return m_ptr; }
+    T& operator*()  const   { return *m_ptr; }
+    operator T*()   const   { return m_ptr; }
+
+    ref_counter * get_counter() const
+    {
+        return m_counter;
+    }
+
+    // a new owner of the borrowed object
+    pointer_type promote() const
+    {
+        pointer_type sp;
+        if (m_counter) {
+            if (!is_immortal(m_counter)) {
+                m_counter->inc_ref();
+            }
+            sp.attach(m_ptr, m_counter);
+        }
+        return sp;
+    }
+
+private:
+    void borrow()
+    {
+#if SMART_PTR_CHECK_BORROWS
+        if (m_counter && !is_immortal(m_counter)) {
+            m_counter->inc_borrow();
+        }
+#endif  // SMART_PTR_CHECK_BORROWS
+    }
+
+    // a borrow is bound to one owner for its whole life, not assignable
+    T * const m_ptr;
+    ref_counter * const m_counter;
+};
+
+
 //////////////////////////////////////////////////////////////////////////
 //
 //   function make_strong_ptr group
 //
 
-template <typename T, typename mem_mgr=std_mem_mgr<T> >
+template <typename T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=typename ref_count_for<T>::type>
 class make_strong_ptr
 {
 public:
-    typedef strong_ptr<T, mem_mgr> pointer_type;
+    typedef strong_ptr<T, mem_mgr, ref_counter> pointer_type;
 
     static pointer_type generate(void)
     {
@@ -447,7 +1444,7 @@ public:
 
 template <typename T>
 strong_ptr<T, com_mem_mgr<T> > make_com_strong_ptr(const T *rawPtr) {
-    return make_strong_ptr<T, com_mem_mgr<T> >::generate<T*>(const_cast<T * &>(rawPtr));
+    return make_strong_ptr<T, com_mem_mgr<T> >::template generate<T*>(const_cast<T * &>(rawPtr));
 }
 
 
@@ -462,12 +1459,16 @@ public:
     static T * allocate(int n) { return new T[n]; }
 };
 
-template <class T, typename mem_mgr=array_mem_mgr<T> >
-class strong_array : public base_ptr<T, true, mem_mgr>
+template <class T, typename mem_mgr=array_mem_mgr<T>, typename ref_counter=typename ref_count_for<T>::type>
+class strong_array : public base_ptr<T, true, mem_mgr, ref_counter>
 {
-    typedef typename base_ptr<T, true, mem_mgr> baseClass;
+    typedef base_ptr<T, true, mem_mgr, ref_counter> baseClass;
 public:
-    explicit strong_array(T* p = 0) : baseClass(p)
+    strong_array()
+    {
+    }
+
+    explicit strong_array(T* p) : baseClass(p)
     {
     }
 
@@ -476,7 +1477,7 @@ public:
     }
 
     template<class Q>
-    strong_array(const strong_array<Q, mem_mgr> &rhs) : baseClass(rhs)
+    strong_array(const strong_array<Q, mem_mgr, ref_counter> &rhs) : baseClass(rhs)
     {
     }
 
@@ -486,12 +1487,12 @@ public:
 
     const T & operator[](int i) const
     {
-        return get()[i];
+        return this->get()[i];
     }
 
     T & operator[](int i)
     {
-        return get()[i];
+        return this->get()[i];
     }
 
     strong_array& operator=(const strong_array &rhs)
@@ -501,7 +1502,7 @@ public:
     }
 
     template <class Q>
-    strong_array& operator=(const strong_array<Q, mem_mgr> &rhs)
+    strong_array& operator=(const strong_array<Q, mem_mgr, ref_counter> &rhs)
     {
         baseClass::operator = (rhs);
         return *this;
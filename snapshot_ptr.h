@@ -0,0 +1,167 @@
+/*
+* snapshot_ptr - read-mostly data published as strong_ptr snapshots.
+*
+* Copyright (c) 2013, Ralph Shane <free2000fly at gmail dot com>
+*
+* Routing and flag tables are read on every request and replaced a few
+* times a minute. Copying one global strong_ptr per read makes every core
+* write the same counter line. A snapshot_publisher holds the current
+* snapshot and a version number; each reader thread keeps a reader with
+* its own copy of the snapshot and only takes a new one when the version
+* has moved, so a read in the steady state is a single load of a line no
+* one writes:
+*
+*     snapshot_publisher<Routes> Routes_publisher;
+*     ...
+*     static thread_local snapshot_publisher<Routes>::reader routes(Routes_publisher);
+*     routes->lookup(host);
+*
+*     Routes_publisher.publish(make_strong_ptr<Routes, std_mem_mgr<Routes>, mt_ref_count>::generate(rules));
+*
+* Snapshots are never modified after publishing; writers build a new one.
+* An old snapshot is freed when the publisher and the last reader that
+* still holds it have moved on, so a reader thread that goes idle keeps
+* its snapshot until its next read or release(). Readers must not outlive
+* their publisher.
+*
+* Requires C++11 (std::atomic, std::mutex).
+*
+* Permission to use, copy, modify, and/or distribute this software for
+* any purpose with or without fee is hereby granted, provided that the
+* above copyright notice and this permission notice appear in all
+* copies.
+*
+* THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+* WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+* AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+* DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+* PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+* TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+* PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef __SNAPSHOT_PTR_H__
+#define __SNAPSHOT_PTR_H__
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include "smart_ptr.h"
+
+namespace smart_ptr {
+
+// Snapshots are shared between threads, so the counter defaults to the
+// interlocked one.
+template <class T, typename mem_mgr=std_mem_mgr<T>, typename ref_counter=mt_ref_count>
+class snapshot_publisher
+{
+    typedef std::atomic<unsigned long long> version_type;
+
+public:
+    typedef strong_ptr<T, mem_mgr, ref_counter> pointer_type;
+
+    // starts at version 0 with no snapshot
+    snapshot_publisher() : m_version(0)
+    {
+    }
+
+    explicit snapshot_publisher(const pointer_type &initial) : m_version(1), m_current(initial)
+    {
+    }
+
+    // make next the current snapshot; readers pick it up on their next read
+    void publish(const pointer_type &next)
+    {
+        pointer_type old;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            old.swap(m_current);
+            m_current = next;
+            m_version.fetch_add(1, std::memory_order_release);
+        }
+        // the old snapshot is released outside the lock, freed here if no reader has it
+    }
+
+    // publish f(current()), with writers going through update() serialized
+    template <typename update_fn>
+    void update(update_fn f)
+    {
+        std::lock_guard<std::mutex> lock(m_update_mutex);
+        publish(f(current()));
+    }
+
+    // a copy of the current snapshot, taken under the lock
+    pointer_type current() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_current;
+    }
+
+    unsigned long long version() const
+    {
+        return m_version.load(std::memory_order_acquire);
+    }
+
+    // one thread's view of the publisher, not to be shared between threads
+    class reader
+    {
+    public:
+        explicit reader(const snapshot_publisher &publisher) : m_publisher(&publisher), m_version(0)
+        {
+        }
+
+        // the current snapshot, valid until this reader's next get() or release()
+        const pointer_type & get()
+        {
+            if (m_publisher->m_version.load(std::memory_order_acquire) != m_version) {
+                refresh();
+            }
+            return m_snapshot;
+        }
+
+        T& operator*()          { return *get(); }
+        T* operator->()         { return get().get(); }
+
+        // the version of the snapshot this reader holds
+        unsigned long long version() const
+        {
+            return m_version;
+        }
+
+        // let go of the snapshot, e.g. before a thread idles for long
+        void release()
+        {
+            m_snapshot.reset();
+            m_version = 0;
+        }
+
+    private:
+        void refresh()
+        {
+            std::lock_guard<std::mutex> lock(m_publisher->m_mutex);
+            m_snapshot = m_publisher->m_current;
+            m_version = m_publisher->m_version.load(std::memory_order_relaxed);
+        }
+
+        const snapshot_publisher *m_publisher;
+        unsigned long long m_version;
+        pointer_type m_snapshot;
+    };
+
+private:
+    snapshot_publisher(const snapshot_publisher &);
+    snapshot_publisher& operator=(const snapshot_publisher &);
+
+    // readers poll the version, keep it off the line the writers lock
+    version_type m_version;
+    char m_pad[SMART_PTR_CACHE_LINE_SIZE - sizeof(version_type)];
+    mutable std::mutex m_mutex;
+    std::mutex m_update_mutex;
+    pointer_type m_current;
+};
+
+}; // namespace smart_ptr
+
+
+#endif // __SNAPSHOT_PTR_H__
@@ -0,0 +1,210 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <assert.h>
+#include "deferred_ref_count.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+namespace {
+    std::atomic<int> Payload_live_count(0);
+}
+
+struct Payload
+{
+    explicit Payload(int _id) : id(_id) { ++Payload_live_count; }
+    ~Payload() { --Payload_live_count; }
+    int id;
+};
+
+typedef strong_ptr<Payload, std_mem_mgr<Payload>, deferred_ref_count> DeferredPtr;
+typedef weak_ptr<Payload, std_mem_mgr<Payload>, deferred_ref_count> DeferredWeakPtr;
+typedef strong_ptr<Payload, std_mem_mgr<Payload>, mt_ref_count> AtomicPtr;
+
+struct Chain
+{
+    Chain() { ++Payload_live_count; }
+    ~Chain() { --Payload_live_count; }
+    strong_ptr<Chain, std_mem_mgr<Chain>, deferred_ref_count> next;
+};
+
+void test_deferred(void)
+{
+    {
+        DeferredPtr p(new Payload(1));
+        DeferredWeakPtr w(p);
+        {
+            DeferredPtr q(p);
+            DeferredPtr r(q);
+            ASSERT( r->id == 1 );
+        }
+        deferred_thread_model::flush();
+        ASSERT( p.use_count() == 1 );     // +2 and -2 cancelled in the log
+        p.reset();
+        ASSERT( Payload_live_count == 1 ); // nothing is freed before a collect
+        ASSERT( !w.expired() );
+
+        // a weak_ptr may still revive it up to the collect
+        DeferredPtr back = w.lock();
+        ASSERT( back.get() != 0 );
+        ASSERT( deferred_thread_model::collect() == 0 );
+        back.reset();
+        ASSERT( deferred_thread_model::collect() == 1 );
+        ASSERT( Payload_live_count == 0 );
+        ASSERT( w.expired() );
+        ASSERT( w.lock().get() == 0 );
+    }
+
+    {
+        // releases made by destructors are handled in the same collect
+        strong_ptr<Chain, std_mem_mgr<Chain>, deferred_ref_count> head(new Chain);
+        head->next.reset(new Chain);
+        head->next->next.reset(new Chain);
+        head.reset();
+        ASSERT( deferred_thread_model::collect() == 3 );
+        ASSERT( Payload_live_count == 0 );
+    }
+
+    {
+        // pointers handed between threads: the -1 on one thread is often
+        // applied long before the +1 on the other
+        std::vector<DeferredPtr> shared;
+        for (int i = 0; i < 64; ++i) {
+            shared.push_back(DeferredPtr(new Payload(i)));
+        }
+        std::atomic<bool> done(false);
+        std::atomic<bool> released(false);
+        std::atomic<int> stopped(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.push_back(std::thread([&shared, &done, &released, &stopped, t]() {
+                std::vector<DeferredPtr> mine;
+                long n = 0;
+                while (!done.load(std::memory_order_relaxed)) {
+                    mine.push_back(shared[(n * 7 + t) % shared.size()]);
+                    if (mine.size() > 16) {
+                        mine.erase(mine.begin());
+                    }
+                    if ((++n & 0xFF) == 0) {
+                        deferred_thread_model::flush();
+                    }
+                }
+                ++stopped;
+                // the main thread now drops its references, ours must keep the objects
+                while (!released.load(std::memory_order_relaxed)) {
+                    for (size_t i = 0; i < mine.size(); ++i) {
+                        ASSERT( mine[i]->id >= 0 && mine[i]->id < 64 );
+                    }
+                    deferred_thread_model::flush();
+                    std::this_thread::yield();
+                }
+                mine.clear();
+                deferred_thread_model::go_offline();
+            }));
+        }
+        for (int round = 0; round < 50; ++round) {
+            deferred_thread_model::collect();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ASSERT( Payload_live_count == 64 );   // everything is still shared
+        done = true;
+        while (stopped < 4) {
+            std::this_thread::yield();
+        }
+        shared.clear();
+        for (int round = 0; round < 20; ++round) {
+            deferred_thread_model::collect();
+        }
+        ASSERT( Payload_live_count > 0 );
+        released = true;
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+        deferred_thread_model::collect();
+        ASSERT( Payload_live_count == 0 );
+    }
+
+    std::cout << "deferred_ref_count OK" << std::endl;
+}
+
+
+// copy-heavy loop: each thread keeps taking and dropping copies of a few hot objects
+template <typename pointer_type, typename flush_fn>
+double run_copies(const std::vector<pointer_type> &hot, int nthreads, long per_thread, flush_fn flush)
+{
+    std::vector<std::thread> threads;
+    std::atomic<long> checksum(0);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int t = 0; t < nthreads; ++t) {
+        threads.push_back(std::thread([&hot, &checksum, per_thread, t, flush]() {
+            pointer_type window[8];
+            long sum = 0;
+            for (long n = 0; n < per_thread; ++n) {
+                window[n & 7] = hot[(n + t) % hot.size()];
+                sum += window[n & 7]->id;
+                if ((n & 0x3FF) == 0x3FF) {
+                    flush();
+                }
+            }
+            for (int i = 0; i < 8; ++i) {
+                window[i].reset();
+            }
+            flush();
+            checksum += sum;
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ASSERT( checksum > 0 );
+    return nthreads * per_thread / seconds / 1e6;
+}
+
+void bench_copies(int nthreads, long per_thread)
+{
+    std::vector<AtomicPtr> atomic_hot;
+    std::vector<DeferredPtr> deferred_hot;
+    for (int i = 1; i <= 4; ++i) {
+        atomic_hot.push_back(AtomicPtr(new Payload(i)));
+        deferred_hot.push_back(DeferredPtr(new Payload(i)));
+    }
+
+    double a = run_copies(atomic_hot, nthreads, per_thread, []() {});
+    double d = run_copies(deferred_hot, nthreads, per_thread, []() { deferred_thread_model::flush(); });
+    printf("%3d threads  mt_ref_count %8.2f  deferred_ref_count %8.2f  Mcopies/s\n", nthreads, a, d);
+
+    deferred_hot.clear();
+    deferred_thread_model::collect();
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_deferred();
+
+    int cores = (int)std::thread::hardware_concurrency();
+    int max_threads = std::max(cores * 2, 64);
+    for (int n = 1; n <= max_threads; n *= 2) {
+        bench_copies(n, 4000000 / n + 100000);
+    }
+
+    deferred_thread_model::statistics stats = deferred_thread_model::get_statistics();
+    printf("updates %llu  counter writes %llu  flushes %llu  collects %llu  freed %llu\n",
+        stats.updates, stats.applied, stats.flushes, stats.collects, stats.reclaimed);
+    ASSERT( Payload_live_count == 0 );
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <assert.h>
+#include "smart_ptr.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+struct Plain  { explicit Plain(int v) : value(v) {}  int value; };
+struct Hot    { explicit Hot(int v) : value(v) {}    int value; };
+struct Watched { explicit Watched(int v) : value(v) {} int value; };
+
+namespace smart_ptr {
+    template <> struct ref_count_layout<Hot>     { typedef cache_line_layout type; };
+    template <> struct ref_count_layout<Watched> { typedef split_layout type; };
+}
+
+typedef strong_ptr<Plain, std_mem_mgr<Plain>, ref_count_for<Plain, multi_thread_model>::type> PlainPtr;
+typedef strong_ptr<Hot, std_mem_mgr<Hot>, ref_count_for<Hot, multi_thread_model>::type> HotPtr;
+typedef strong_ptr<Watched, std_mem_mgr<Watched>, ref_count_for<Watched, multi_thread_model>::type> WatchedPtr;
+typedef weak_ptr<Watched, std_mem_mgr<Watched>, ref_count_for<Watched, multi_thread_model>::type> WatchedWeakPtr;
+typedef weak_ptr<Hot, std_mem_mgr<Hot>, ref_count_for<Hot, multi_thread_model>::type> HotWeakPtr;
+
+void test_layouts(void)
+{
+    ASSERT( sizeof(ref_count_for<Plain>::type) == (SMART_PTR_CHECK_BORROWS ? 3 : 2) * sizeof(int) );
+    ASSERT( sizeof(ref_count_for<Hot>::type) == SMART_PTR_CACHE_LINE_SIZE );
+    ASSERT( sizeof(ref_count_for<Watched>::type) == 2 * SMART_PTR_CACHE_LINE_SIZE );
+
+    // the default counter follows the trait
+    strong_ptr<Hot> h(new Hot(1));
+    ASSERT( sizeof(*h.get_counter()) == SMART_PTR_CACHE_LINE_SIZE );
+    strong_ptr<Plain> p(new Plain(2));
+    ASSERT( sizeof(*p.get_counter()) == sizeof(ref_count) );
+
+    std::vector<HotPtr> hot;
+    std::vector<WatchedPtr> watched;
+    for (int i = 0; i < 16; ++i) {
+        hot.push_back(HotPtr(new Hot(i)));
+        watched.push_back(WatchedPtr(new Watched(i)));
+        ASSERT( (size_t)hot.back().get_counter() % SMART_PTR_CACHE_LINE_SIZE == 0 );
+        ASSERT( (size_t)watched.back().get_counter() % SMART_PTR_CACHE_LINE_SIZE == 0 );
+    }
+
+    HotPtr h2(hot[3]);
+    HotWeakPtr hw(h2);
+    ASSERT( h2.use_count() == 2 );
+    ASSERT( h2.get_counter()->get_weak_ref_count() == 1 );
+    hot.clear();
+    ASSERT( h2.unique() && h2->value == 3 );
+    h2.reset();
+    ASSERT( hw.expired() );
+
+    WatchedWeakPtr ww(watched[5]);
+    WatchedPtr w2 = ww.lock();
+    ASSERT( w2.use_count() == 2 && w2->value == 5 );
+    watched.clear();
+    w2.reset();
+    ASSERT( ww.expired() && ww.lock().get() == 0 );
+
+    std::cout << "counter layouts OK" << std::endl;
+}
+
+
+// every thread copies a pointer to its own object; the objects were
+// allocated one after another, so compact counters share cache lines
+template <typename pointer_type, typename value_type>
+double run_private_copies(int nthreads, long per_thread)
+{
+    std::vector<pointer_type> objects;
+    for (int i = 0; i < nthreads; ++i) {
+        objects.push_back(pointer_type(new value_type(i)));
+    }
+    std::vector<std::thread> threads;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int t = 0; t < nthreads; ++t) {
+        threads.push_back(std::thread([&objects, per_thread, t]() {
+            long sum = 0;
+            for (long n = 0; n < per_thread; ++n) {
+                pointer_type copy(objects[t]);
+                sum += copy->value;
+            }
+            ASSERT( sum == (long)t * per_thread );
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return nthreads * per_thread / seconds / 1e6;
+}
+
+// one object, half of the threads copy strong_ptrs, the other half weak_ptrs
+template <typename pointer_type, typename weak_type, typename value_type>
+double run_mixed_copies(int nthreads, long per_thread)
+{
+    pointer_type object(new value_type(1));
+    weak_type watcher(object);
+    std::vector<std::thread> threads;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int t = 0; t < nthreads; ++t) {
+        threads.push_back(std::thread([&object, &watcher, per_thread, t]() {
+            for (long n = 0; n < per_thread; ++n) {
+                if (t & 1) {
+                    weak_type copy(watcher);
+                    ASSERT( !copy.expired() );
+                } else {
+                    pointer_type copy(object);
+                    ASSERT( copy->value == 1 );
+                }
+            }
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return nthreads * per_thread / seconds / 1e6;
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_layouts();
+
+    int cores = (int)std::thread::hardware_concurrency();
+    int max_threads = std::max(cores, 8);
+    for (int n = 2; n <= max_threads; n *= 2) {
+        long per_thread = 2000000;
+        double compact = run_private_copies<PlainPtr, Plain>(n, per_thread);
+        double padded = run_private_copies<HotPtr, Hot>(n, per_thread);
+        double line = run_mixed_copies<HotPtr, HotWeakPtr, Hot>(n, per_thread);
+        double split = run_mixed_copies<WatchedPtr, WatchedWeakPtr, Watched>(n, per_thread);
+        printf("%3d threads  own object: compact %7.2f  cache_line %7.2f   "
+            "strong+weak on one: cache_line %7.2f  split %7.2f  Mcopies/s\n",
+            n, compact, padded, line, split);
+    }
+    return 0;
+}
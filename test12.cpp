@@ -0,0 +1,163 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <assert.h>
+#include "lockfree_queue.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+namespace {
+    std::atomic<int> Foo_live_count(0);
+}
+
+struct Foo
+{
+    Foo( int _x ) : x(_x) { ++Foo_live_count; }
+    ~Foo() { --Foo_live_count; }
+    int x;
+};
+
+// the same counters with their blocks straight from the heap, for comparison
+template <typename threading_model>
+class heap_ref_count : public basic_ref_count<threading_model>
+{
+public:
+    static void * operator new(size_t size) { return ::operator new(size); }
+    static void operator delete(void *p) { ::operator delete(p); }
+};
+
+typedef strong_ptr<Foo> FooPtr;
+typedef strong_ptr<Foo, std_mem_mgr<Foo>, heap_ref_count<single_thread_model> > HeapFooPtr;
+typedef strong_ptr<Foo, std_mem_mgr<Foo>, mt_ref_count> MtFooPtr;
+typedef strong_ptr<Foo, std_mem_mgr<Foo>, heap_ref_count<multi_thread_model> > HeapMtFooPtr;
+
+void test_block_cache(void)
+{
+#if SMART_PTR_BLOCK_CACHE
+    {
+        // a freed block is handed to the next pointer created on this thread
+        FooPtr a(new Foo(1));
+        ref_count *block = a.get_counter();
+        a.reset();
+        FooPtr b(new Foo(2));
+        ASSERT( b.get_counter() == block );
+        weak_ptr<Foo> w(b);
+        b.reset();
+        ASSERT( w.expired() );      // the block lives on for the weak_ptr
+        FooPtr c(new Foo(3));
+        ASSERT( c.get_counter() != block );
+    }
+
+    {
+        // blocks freed on a consumer thread go back to the producer through the depot
+        strong_ptr_queue<Foo> queue(4096);
+        std::thread consumer([&queue]() {
+            MtFooPtr p;
+            long seen = 0;
+            while (seen < 100000) {
+                if (queue.try_pop(p)) {
+                    ASSERT( p->x == (int)seen );
+                    p.reset();
+                    ++seen;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        for (int i = 0; i < 100000; ++i) {
+            MtFooPtr p(new Foo(i));
+            while (!queue.try_push(std::move(p))) {
+                std::this_thread::yield();
+            }
+        }
+        consumer.join();
+    }
+
+    {
+        // threads exiting with cached blocks
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; ++t) {
+            threads.push_back(std::thread([t]() {
+                std::vector<MtFooPtr> keep;
+                for (int i = 0; i < 1000; ++i) {
+                    keep.push_back(MtFooPtr(new Foo(t)));
+                }
+            }));
+        }
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+    }
+#endif  // SMART_PTR_BLOCK_CACHE
+    ASSERT( Foo_live_count == 0 );
+
+    std::cout << "counter block cache OK" << std::endl;
+}
+
+
+// the FooPtr foo_ptr(new Foo(...)) / reset pattern of test3.cpp
+template <typename pointer_type>
+double run_resets(long iterations)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pointer_type foo_ptr( new Foo( 2 ) );
+    std::vector<pointer_type> foo_vector;
+    for (long n = 0; n < iterations; ++n) {
+        foo_ptr.reset( new Foo( (int)n ) );
+        if ((n & 15) == 0) {
+            foo_vector.push_back( foo_ptr );
+        }
+        if (foo_vector.size() == 64) {
+            foo_vector.clear();
+        }
+    }
+    foo_ptr.reset();
+    foo_vector.clear();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return iterations / seconds / 1e6;
+}
+
+template <typename pointer_type>
+double run_resets_threaded(int nthreads, long iterations)
+{
+    std::vector<std::thread> threads;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int t = 0; t < nthreads; ++t) {
+        threads.push_back(std::thread([iterations]() {
+            run_resets<pointer_type>(iterations);
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return nthreads * iterations / seconds / 1e6;
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_block_cache();
+
+    const long iterations = 5000000;
+    printf("ref_count     heap %6.2f  cached %6.2f  Mresets/s\n",
+        run_resets<HeapFooPtr>(iterations), run_resets<FooPtr>(iterations));
+    printf("mt_ref_count  heap %6.2f  cached %6.2f  Mresets/s\n",
+        run_resets<HeapMtFooPtr>(iterations), run_resets<MtFooPtr>(iterations));
+    printf("4 threads     heap %6.2f  cached %6.2f  Mresets/s\n",
+        run_resets_threaded<HeapMtFooPtr>(4, iterations / 4), run_resets_threaded<MtFooPtr>(4, iterations / 4));
+    ASSERT( Foo_live_count == 0 );
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <assert.h>
+#include "lazy_ptr.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+namespace {
+    std::atomic<int> Component_built(0);
+    std::atomic<int> Component_live(0);
+}
+
+// an optional part of a service, expensive to set up
+struct Component
+{
+    Component(int _id, const std::string &_name) : id(_id), name(_name), table(4096)
+    {
+        for (size_t i = 0; i < table.size(); ++i) {
+            table[i] = (int)(i * 31 + _id);
+        }
+        ++Component_built;
+        ++Component_live;
+    }
+    ~Component() { --Component_live; }
+
+    int id;
+    std::string name;
+    std::vector<int> table;
+};
+
+typedef strong_ptr<Component, std_mem_mgr<Component>, mt_ref_count> ComponentPtr;
+typedef weak_ptr<Component, std_mem_mgr<Component>, mt_ref_count> ComponentWeakPtr;
+typedef lazy_strong_ptr<Component> LazyComponent;
+
+void test_lazy(void)
+{
+    {
+        LazyComponent lc = make_lazy_ptr<Component>::generate(7, "seven");
+        LazyComponent copy(lc);
+        ASSERT( !lc.initialized() && Component_built == 0 );
+        ASSERT( lc->id == 7 && lc->name == "seven" );
+        ASSERT( Component_built == 1 );
+        ASSERT( copy.initialized() && copy.get() == lc.get() );   // copies share the object
+
+        ComponentPtr sp = lc;
+        ComponentWeakPtr wp = copy.weak();
+        ASSERT( sp.use_count() == 2 );
+        lc.reset();
+        copy.reset();
+        ASSERT( sp.unique() && !wp.expired() );
+        sp.reset();
+        ASSERT( wp.expired() && Component_live == 0 );
+
+        // never used, never built
+        LazyComponent unused = make_lazy_ptr<Component>::generate(8, "eight");
+        ASSERT( Component_built == 1 );
+
+        LazyComponent ready(ComponentPtr(new Component(9, "nine")));
+        ASSERT( ready.initialized() && ready->id == 9 );
+
+        LazyComponent empty;
+        ASSERT( empty.empty() && empty.get() == 0 && empty.strong().get() == 0 );
+    }
+    ASSERT( Component_live == 0 );
+
+    {
+        // threads racing for the first dereference get one object
+        for (int round = 0; round < 100; ++round) {
+            Component_built = 0;
+            LazyComponent lc = make_lazy_ptr<Component>::generate(round, "race");
+            std::atomic<bool> go(false);
+            std::vector<std::thread> threads;
+            std::vector<Component *> seen(8);
+            for (int t = 0; t < 8; ++t) {
+                threads.push_back(std::thread([&lc, &go, &seen, t]() {
+                    while (!go) {
+                        std::this_thread::yield();
+                    }
+                    seen[t] = lc.get();
+                }));
+            }
+            go = true;
+            for (int t = 0; t < 8; ++t) {
+                threads[t].join();
+                ASSERT( seen[t] == seen[0] && seen[t]->id == round );
+            }
+            ASSERT( Component_built == 1 );
+        }
+    }
+    ASSERT( Component_live == 0 );
+
+    {
+        std::vector<LazyComponent> parts;
+        for (int i = 0; i < 32; ++i) {
+            parts.push_back(make_lazy_ptr<Component>::generate(i, "part"));
+        }
+        Component_built = 0;
+        prewarm(parts.begin(), parts.end(), 4);
+        ASSERT( Component_built == 32 );
+        for (int i = 0; i < 32; ++i) {
+            ASSERT( parts[i].initialized() && parts[i]->id == i );
+        }
+    }
+    ASSERT( Component_live == 0 );
+
+    std::cout << "lazy_strong_ptr OK" << std::endl;
+}
+
+
+// a service with many optional components, each request touches a few of them
+void bench_service(int components, int requests, int touched_percent)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    std::vector<ComponentPtr> eager;
+    for (int i = 0; i < components; ++i) {
+        eager.push_back(make_strong_ptr<Component, std_mem_mgr<Component>, mt_ref_count>::generate(i, "component"));
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    Component_built = 0;
+    std::vector<LazyComponent> lazy;
+    for (int i = 0; i < components; ++i) {
+        lazy.push_back(make_lazy_ptr<Component>::generate(i, "component"));
+    }
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+    int spread = components * touched_percent / 100;
+    if (spread < 1) {
+        spread = 1;
+    }
+    long eager_sum = 0, lazy_sum = 0;
+    std::chrono::steady_clock::time_point t3 = std::chrono::steady_clock::now();
+    for (int r = 0; r < requests; ++r) {
+        eager_sum += eager[(r * 7) % spread]->table[r & 1023];
+    }
+    std::chrono::steady_clock::time_point t4 = std::chrono::steady_clock::now();
+    for (int r = 0; r < requests; ++r) {
+        lazy_sum += lazy[(r * 7) % spread]->table[r & 1023];
+    }
+    std::chrono::steady_clock::time_point t5 = std::chrono::steady_clock::now();
+    ASSERT( eager_sum == lazy_sum );
+
+    size_t object_bytes = sizeof(Component) + 4096 * sizeof(int);
+    printf("%d components, %d%% used: startup eager %8.3f ms  lazy %8.3f ms;  "
+        "objects built eager %d  lazy %d (~%zu KB vs %zu KB);  access %5.2f vs %5.2f ns\n",
+        components, touched_percent,
+        std::chrono::duration<double, std::milli>(t1 - t0).count(),
+        std::chrono::duration<double, std::milli>(t2 - t1).count(),
+        components, (int)Component_built,
+        components * object_bytes / 1024, Component_built * object_bytes / 1024,
+        std::chrono::duration<double, std::nano>(t4 - t3).count() / requests,
+        std::chrono::duration<double, std::nano>(t5 - t4).count() / requests);
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_lazy();
+
+    bench_service(1000, 10000000, 5);
+    bench_service(1000, 10000000, 25);
+    bench_service(10000, 10000000, 5);
+    return 0;
+}
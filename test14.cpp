@@ -0,0 +1,184 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <stdio.h>
+#include <assert.h>
+#include "array_slice.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+namespace {
+    int Buffer_freed = 0;
+}
+
+template<typename T>
+class counting_array_mem_mgr {
+public:
+    static void deallocate(T *p) { ++Buffer_freed; delete []p; }
+    static T * allocate(int n) { return new T[n]; }
+};
+
+typedef array_slice<double> Slice;
+typedef strong_array<double, array_mem_mgr<double>, mt_ref_count> Buffer;
+
+void test_slices(void)
+{
+    typedef array_slice<double, counting_array_mem_mgr<double>, mt_ref_count> CountedSlice;
+    CountedSlice all = make_array_slice<double, counting_array_mem_mgr<double>, mt_ref_count>::generate(100);
+    for (size_t i = 0; i < all.size(); ++i) {
+        all[i] = (double)i;
+    }
+    ASSERT( all.use_count() == 1 );
+
+    CountedSlice left, right;
+    all.split(40, left, right);
+    ASSERT( left.size() == 40 && right.size() == 60 );
+    ASSERT( right[0] == 40.0 && right.offset() == 40 );
+    ASSERT( all.use_count() == 3 );
+
+    // splitting a slice into itself
+    CountedSlice self(all), other;
+    self.split(30, self, other);
+    ASSERT( self.size() == 30 && other.size() == 70 && other[0] == 30.0 );
+    self = all;
+    self.split(30, other, self);
+    ASSERT( other.size() == 30 && self.size() == 70 && self[0] == 30.0 );
+    self.reset();
+    other.reset();
+
+    CountedSlice mid = right.subslice(10, 1000);       // clamped to the end
+    ASSERT( mid.size() == 50 && mid[0] == 50.0 );
+    CountedSlice none = right.subslice(100, 5);
+    ASSERT( none.empty() );
+
+    CountedSlice rest(all);
+    CountedSlice head = rest.take_front(25);
+    ASSERT( head.size() == 25 && rest.size() == 75 && rest[0] == 25.0 );
+
+    // the buffer stays alive as long as any slice does
+    all.reset();
+    left.reset();
+    right.reset();
+    none.reset();
+    rest.reset();
+    head.reset();
+    ASSERT( Buffer_freed == 0 && mid.use_count() == 1 && mid[49] == 99.0 );
+
+#if SMART_PTR_HAS_RVALUE_REFS
+    int before = mid.use_count();
+    CountedSlice moved(std::move(mid));
+    ASSERT( moved.use_count() == before && mid.empty() && mid.data() == 0 );
+#else
+    CountedSlice moved(mid);
+    mid.reset();
+#endif  // SMART_PTR_HAS_RVALUE_REFS
+    moved.reset();
+    ASSERT( Buffer_freed == 1 );
+
+    Buffer raw(new double[8]);
+    Slice first_half(raw, 0, 4);
+    ASSERT( first_half.data() == raw.get() && first_half.end() == raw.get() + 4 );
+
+    std::cout << "array_slice OK" << std::endl;
+}
+
+
+// sum a buffer on nthreads workers, each owning a disjoint slice
+double reduce_sliced(const Slice &buffer, int nthreads)
+{
+    std::vector<double> partial(nthreads);
+    std::vector<std::thread> workers;
+    Slice rest(buffer);
+    size_t chunk = (buffer.size() + nthreads - 1) / nthreads;
+    for (int t = 0; t < nthreads; ++t) {
+        Slice part = rest.take_front(chunk);
+        workers.push_back(std::thread([&partial, t](Slice mine) {
+            double sum = 0;
+            for (Slice::iterator it = mine.begin(); it != mine.end(); ++it) {
+                sum += *it;
+            }
+            partial[t] = sum;
+        }, std::move(part)));
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+    double total = 0;
+    for (int t = 0; t < nthreads; ++t) {
+        total += partial[t];
+    }
+    return total;
+}
+
+// the old way: every worker copies the whole strong_array and gets its bounds on the side
+double reduce_bounds(const Buffer &buffer, size_t length, int nthreads)
+{
+    std::vector<double> partial(nthreads);
+    std::vector<std::thread> workers;
+    size_t chunk = (length + nthreads - 1) / nthreads;
+    for (int t = 0; t < nthreads; ++t) {
+        size_t first = std::min(length, t * chunk);
+        size_t last = std::min(length, first + chunk);
+        workers.push_back(std::thread([&partial, t, first, last](Buffer mine) {
+            double sum = 0;
+            for (size_t i = first; i < last; ++i) {
+                sum += mine[(int)i];
+            }
+            partial[t] = sum;
+        }, buffer));
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+    double total = 0;
+    for (int t = 0; t < nthreads; ++t) {
+        total += partial[t];
+    }
+    return total;
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_slices();
+
+    const size_t n = 32 * 1024 * 1024;
+    Slice buffer = make_array_slice<double>::generate(n);
+    for (size_t i = 0; i < n; ++i) {
+        buffer[i] = (double)(i & 1023);
+    }
+    double expected = (double)(n / 1024) * (1023.0 * 1024 / 2);
+
+    int cores = (int)std::thread::hardware_concurrency();
+    int max_threads = std::max(cores, 4);
+    for (int t = 1; t <= max_threads; t *= 2) {
+        const int rounds = 5;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; ++r) {
+            ASSERT( reduce_sliced(buffer, t) == expected );
+        }
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; ++r) {
+            ASSERT( reduce_bounds(buffer.array(), n, t) == expected );
+        }
+        std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+        double bytes = (double)n * sizeof(double) * rounds;
+        printf("%2d workers  slices %6.2f GB/s  whole array + bounds %6.2f GB/s\n", t,
+            bytes / std::chrono::duration<double>(t1 - t0).count() / 1e9,
+            bytes / std::chrono::duration<double>(t2 - t1).count() / 1e9);
+    }
+    ASSERT( buffer.use_count() == 1 );
+    return 0;
+}
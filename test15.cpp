@@ -0,0 +1,159 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <assert.h>
+#include "parallel_ptr.h"
+
+#if defined(__has_include)
+#if __has_include(<execution>) && __cplusplus >= 201703L
+#include <execution>
+#endif
+#endif
+#if defined(__cpp_lib_parallel_algorithm)
+#define HAVE_STD_EXECUTION 1
+#endif
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+struct Foo
+{
+    Foo( int _x ) : x(_x) {}
+    int x;
+};
+
+typedef strong_ptr<Foo, std_mem_mgr<Foo>, mt_ref_count> FooPtr;
+
+std::vector<FooPtr> make_foos(size_t n)
+{
+    std::vector<FooPtr> v;
+    unsigned seed = 12345;
+    for (size_t i = 0; i < n; ++i) {
+        seed = seed * 1103515245 + 12345;
+        v.push_back(FooPtr(new Foo((int)(seed >> 8) % 1000000)));
+    }
+    return v;
+}
+
+void test_algorithms(void)
+{
+    std::vector<FooPtr> v = make_foos(50000);
+    FooPtr watched = v[123];
+    ASSERT( watched.use_count() == 2 );
+
+    std::atomic<long> sum(0);
+    long expected = 0;
+    for (size_t i = 0; i < v.size(); ++i) {
+        expected += v[i]->x;
+    }
+    parallel_for_each(v.begin(), v.end(), [&sum](Foo *f) { sum += f->x; }, 4);
+    ASSERT( sum == expected );
+
+    std::vector<int> doubled(v.size());
+    parallel_transform(v.begin(), v.end(), doubled.begin(), [](const Foo *f) { return f->x * 2; }, 4);
+    for (size_t i = 0; i < v.size(); ++i) {
+        ASSERT( doubled[i] == v[i]->x * 2 );
+    }
+
+    parallel_sort(v.begin(), v.end(), [](const Foo *a, const Foo *b) { return a->x > b->x; }, 4);
+    for (size_t i = 1; i < v.size(); ++i) {
+        ASSERT( v[i - 1]->x >= v[i]->x );
+    }
+    ASSERT( watched.use_count() == 2 );       // moved around, never copied
+
+    std::vector<FooPtr>::iterator mid = parallel_partition(v.begin(), v.end(),
+        [](const Foo *f) { return (f->x & 1) == 0; }, 4);
+    for (std::vector<FooPtr>::iterator it = v.begin(); it != v.end(); ++it) {
+        ASSERT( ((*it)->x & 1) == (it < mid ? 0 : 1) );
+    }
+    // stable: the even half is still sorted
+    for (std::vector<FooPtr>::iterator it = v.begin() + 1; it < mid; ++it) {
+        ASSERT( (*(it - 1))->x >= (*it)->x );
+    }
+    ASSERT( watched.use_count() == 2 );
+
+    std::vector<FooPtr> empty;
+    parallel_sort(empty.begin(), empty.end(), [](const Foo *a, const Foo *b) { return a->x < b->x; });
+    ASSERT( parallel_partition(empty.begin(), empty.end(), [](const Foo *) { return true; }) == empty.end() );
+
+    std::cout << "parallel algorithms OK" << std::endl;
+}
+
+
+template <typename fn>
+double time_ms(fn f)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+void bench(size_t n)
+{
+    std::vector<FooPtr> a = make_foos(n);
+    std::vector<FooPtr> b = a;
+    std::vector<int> out(n);
+    std::atomic<long> sink(0);
+
+    double ours[4], theirs[4] = { 0, 0, 0, 0 };
+    ours[0] = time_ms([&]() {
+        parallel_for_each(a.begin(), a.end(), [&sink](const Foo *f) { if (f->x == -1) ++sink; });
+    });
+    ours[1] = time_ms([&]() {
+        parallel_transform(a.begin(), a.end(), out.begin(), [](const Foo *f) { return f->x + 1; });
+    });
+    ours[2] = time_ms([&]() {
+        parallel_sort(a.begin(), a.end(), [](const Foo *l, const Foo *r) { return l->x < r->x; });
+    });
+    ours[3] = time_ms([&]() {
+        parallel_partition(a.begin(), a.end(), [](const Foo *f) { return f->x < 500000; });
+    });
+
+#if HAVE_STD_EXECUTION
+    // the usual way of writing it, pointers taken by value
+    theirs[0] = time_ms([&]() {
+        std::for_each(std::execution::par, b.begin(), b.end(), [&sink](FooPtr p) { if (p->x == -1) ++sink; });
+    });
+    theirs[1] = time_ms([&]() {
+        std::transform(std::execution::par, b.begin(), b.end(), out.begin(), [](FooPtr p) { return p->x + 1; });
+    });
+    theirs[2] = time_ms([&]() {
+        std::sort(std::execution::par, b.begin(), b.end(), [](FooPtr l, FooPtr r) { return l->x < r->x; });
+    });
+    theirs[3] = time_ms([&]() {
+        std::stable_partition(std::execution::par, b.begin(), b.end(), [](FooPtr p) { return p->x < 500000; });
+    });
+#endif  // HAVE_STD_EXECUTION
+
+    static const char *names[] = { "for_each", "transform", "sort", "partition" };
+    for (int i = 0; i < 4; ++i) {
+        printf("%zu elements  %-10s parallel_ptr %8.2f ms   std::execution::par %8.2f ms\n",
+            n, names[i], ours[i], theirs[i]);
+    }
+    ASSERT( sink == 0 );
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_algorithms();
+
+#if !HAVE_STD_EXECUTION
+    printf("no <execution> here, the std::execution::par column is left at 0\n");
+#endif  // !HAVE_STD_EXECUTION
+    bench(1000000);
+    bench(4000000);
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <stdio.h>
+#include <assert.h>
+
+// debug builds check borrows, record violations instead of aborting
+namespace {
+    int Borrow_violations = 0;
+}
+#define SMART_PTR_BORROW_VIOLATION() (++Borrow_violations)
+
+#include "smart_ptr.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+struct Node
+{
+    Node( int _x ) : x(_x) {}
+    virtual ~Node() {}
+    int x;
+};
+
+struct Leaf : public Node
+{
+    Leaf( int _x ) : Node(_x) {}
+};
+
+typedef strong_ptr<Node, std_mem_mgr<Node>, mt_ref_count> NodePtr;
+typedef strong_ptr<Leaf, std_mem_mgr<Leaf>, mt_ref_count> LeafPtr;
+typedef weak_ptr<Node, std_mem_mgr<Node>, mt_ref_count> NodeWeakPtr;
+typedef strong_ref<Node, std_mem_mgr<Node>, mt_ref_count> NodeRef;
+
+int read_borrowed(NodeRef r)
+{
+    return r->x;
+}
+
+void test_borrow(void)
+{
+    NodePtr owner(new Node(5));
+    {
+        NodeRef r(owner);
+        NodeRef copy(r);
+        ASSERT( owner.use_count() == 1 );           // borrowing is free
+#if SMART_PTR_CHECK_BORROWS
+        ASSERT( owner.get_counter()->get_borrow_count() == 2 );
+#endif  // SMART_PTR_CHECK_BORROWS
+        ASSERT( r.get() == owner.get() && (*copy).x == 5 && read_borrowed(owner) == 5 );
+
+        NodePtr promoted = copy.promote();
+        ASSERT( owner.use_count() == 2 && promoted.get() == owner.get() );
+    }
+    ASSERT( owner.use_count() == 1 );
+
+    // from a derived owner
+    LeafPtr leaf(new Leaf(7));
+    NodeRef base_ref(leaf);
+    ASSERT( base_ref->x == 7 && base_ref.get_counter() == leaf.get_counter() );
+
+    NodePtr none;
+    NodeRef empty(none);
+    ASSERT( empty.get() == 0 && empty.promote().get() == 0 );
+
+    ASSERT( Borrow_violations == 0 );
+#if SMART_PTR_CHECK_BORROWS
+    ASSERT( owner.get_counter()->get_borrow_count() == 0 );
+
+    // the owner goes away while a borrow is still out, the weak_ptr keeps
+    // the counter block around for ~strong_ref
+    {
+        NodePtr shortlived(new Node(1));
+        NodeWeakPtr block(shortlived);
+        NodeRef dangling(shortlived);
+        NodePtr keep = dangling.promote();
+        shortlived.reset();
+        ASSERT( Borrow_violations == 0 );           // keep still owns it
+        keep.reset();
+        ASSERT( Borrow_violations == 1 && block.expired() );
+    }
+#endif  // SMART_PTR_CHECK_BORROWS
+
+    std::cout << "strong_ref OK" << std::endl;
+}
+
+
+// a call chain of depth levels, passing the pointer the three ways
+#if defined(_MSC_VER)
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
+// every level does some work, so the chain is not folded into a loop
+volatile int Chain_work = 0;
+
+NOINLINE int by_value(NodePtr p, int depth)
+{
+    Chain_work = depth;
+    return depth == 0 ? p->x : by_value(p, depth - 1) + 1;
+}
+
+NOINLINE int by_const_ref(const NodePtr &p, int depth)
+{
+    Chain_work = depth;
+    return depth == 0 ? p->x : by_const_ref(p, depth - 1) + 1;
+}
+
+NOINLINE int by_borrow(NodeRef p, int depth)
+{
+    Chain_work = depth;
+    return depth == 0 ? p->x : by_borrow(p, depth - 1) + 1;
+}
+
+template <typename fn>
+double ns_per_call(const NodePtr &p, int nthreads, int calls, fn f)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t) {
+        threads.push_back(std::thread([&p, calls, f]() {
+            long sum = 0;
+            for (int i = 0; i < calls; ++i) {
+                sum += f(p);
+            }
+            ASSERT( sum == (long)calls * (p->x + 16) );
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / calls;
+}
+
+void bench(int nthreads, int calls)
+{
+    NodePtr shared(new Node(3));
+    double value = ns_per_call(shared, nthreads, calls, [](const NodePtr &p) { return by_value(p, 16); });
+    double cref = ns_per_call(shared, nthreads, calls, [](const NodePtr &p) { return by_const_ref(p, 16); });
+    double borrow = ns_per_call(shared, nthreads, calls, [](const NodePtr &p) { return by_borrow(p, 16); });
+    printf("depth 16, %2d threads: by value %8.2f ns  const& %8.2f ns  strong_ref %8.2f ns  %s\n",
+        nthreads, value, cref, borrow, SMART_PTR_CHECK_BORROWS ? "(borrows checked)" : "");
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_borrow();
+
+    int cores = (int)std::thread::hardware_concurrency();
+    bench(1, 2000000);
+    if (cores > 1) {
+        bench(cores, 500000);
+    }
+    return 0;
+}
@@ -0,0 +1,208 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <assert.h>
+#include "smart_ptr.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+namespace {
+    std::atomic<int> Freed(0);
+}
+
+template<typename T>
+class counting_mem_mgr {
+public:
+    static void deallocate(T *p) { ++Freed; delete p; }
+};
+
+struct Plain { int x; };
+struct Wide { int x; };
+struct Small { int x; };
+struct Packed { int x; };
+struct SmallPacked { int x; };
+
+namespace smart_ptr {
+    template <> struct ref_count_width<Wide> { typedef wide_counts type; };
+    template <> struct ref_count_width<Small> { typedef small_counts type; };
+    template <> struct ref_count_layout<Packed> { typedef packed_layout type; };
+    template <> struct ref_count_width<SmallPacked> { typedef small_counts type; };
+    template <> struct ref_count_layout<SmallPacked> { typedef packed_layout type; };
+}
+
+void test_widths(void)
+{
+    ASSERT( sizeof(ref_count_for<Small>::type) == (SMART_PTR_CHECK_BORROWS ? 3 : 2) * sizeof(short) );
+    ASSERT( sizeof(ref_count_for<Wide>::type) == (SMART_PTR_CHECK_BORROWS ? 3 : 2) * sizeof(long long) );
+    ASSERT( sizeof(ref_count_for<Packed>::type) == (SMART_PTR_CHECK_BORROWS ? 16 : 8) );
+    ASSERT( sizeof(ref_count_for<SmallPacked>::type) == (SMART_PTR_CHECK_BORROWS ? 8 : 4) );
+
+    // 64-bit counts go past 2^31 and come back
+    {
+        basic_ref_count<single_thread_model, compact_layout, wide_counts> c;
+        const long long n = 0x80000010LL;
+        for (long long i = 0; i < n; ++i) {
+            c.inc_ref();
+        }
+        ASSERT( c.get_ref_count() == INT_MAX );
+        for (long long i = 0; i < n; ++i) {
+            ASSERT( c.dec_ref() != 0 );
+        }
+        ASSERT( c.get_ref_count() == 1 && c.dec_ref() == 0 );
+    }
+
+    // 16-bit counts stick instead of wrapping, and stay stuck
+    {
+        basic_ref_count<single_thread_model, compact_layout, small_counts> c;
+        for (int i = 0; i < 100000; ++i) {
+            c.inc_ref();
+        }
+        int stuck = c.get_ref_count();
+        ASSERT( stuck == small_counts::stuck_count() );
+        for (int i = 0; i < 200000; ++i) {
+            ASSERT( c.dec_ref() == stuck );
+        }
+        ASSERT( c.inc_ref_if_alive() && !c.expired() );
+        for (int i = 0; i < 100000; ++i) {
+            c.inc_weak_ref();
+        }
+        ASSERT( c.dec_weak_ref() == stuck );
+    }
+
+    // the same in one packed word, the other half is left alone
+    {
+        basic_ref_count<multi_thread_model, packed_layout, small_counts> c;
+        c.inc_weak_ref();
+        for (int i = 0; i < 100000; ++i) {
+            c.inc_ref();
+        }
+        ASSERT( c.get_ref_count() == small_counts::stuck_count() );
+        ASSERT( c.get_weak_ref_count() == 1 );
+        ASSERT( c.dec_ref() != 0 && c.dec_weak_ref() == 1 );
+    }
+
+    // packed: with no weak_ptr the last owner drops both counts at once
+    {
+        typedef strong_ptr<Packed, counting_mem_mgr<Packed>, ref_count_for<Packed, multi_thread_model>::type> PackedPtr;
+        typedef weak_ptr<Packed, counting_mem_mgr<Packed>, ref_count_for<Packed, multi_thread_model>::type> PackedWeakPtr;
+        Freed = 0;
+        PackedPtr p(new Packed());
+        PackedPtr q(p);
+        PackedWeakPtr w(p);
+        ASSERT( p.use_count() == 2 && p.get_counter()->get_weak_ref_count() == 1 );
+        q.reset();
+        ASSERT( w.lock().get() == p.get() );
+        w.reset();
+        ASSERT( p.use_count() == 1 && p.get_counter()->get_weak_ref_count() == 0 );
+        p.reset();
+        ASSERT( Freed == 1 );
+
+        // a weak_ptr outliving the object still frees the block
+        PackedPtr r(new Packed());
+        PackedWeakPtr watch(r);
+        r.reset();
+        ASSERT( Freed == 2 && watch.expired() && watch.lock().get() == 0 );
+    }
+
+    // packed pointers copied and locked from many threads
+    {
+        typedef strong_ptr<SmallPacked, counting_mem_mgr<SmallPacked>, ref_count_for<SmallPacked, multi_thread_model>::type> NodePtr;
+        typedef weak_ptr<SmallPacked, counting_mem_mgr<SmallPacked>, ref_count_for<SmallPacked, multi_thread_model>::type> NodeWeakPtr;
+        Freed = 0;
+        for (int round = 0; round < 200; ++round) {
+            NodePtr shared(new SmallPacked());
+            NodeWeakPtr watch(shared);
+            std::vector<std::thread> threads;
+            for (int t = 0; t < 4; ++t) {
+                threads.push_back(std::thread([shared, watch]() {
+                    for (int i = 0; i < 200; ++i) {
+                        NodePtr a(shared);
+                        NodeWeakPtr b(watch);
+                        NodePtr c = b.lock();
+                        ASSERT( c.get() == a.get() );
+                    }
+                }));
+            }
+            shared.reset();
+            for (size_t t = 0; t < threads.size(); ++t) {
+                threads[t].join();
+            }
+            ASSERT( watch.expired() );
+        }
+        ASSERT( Freed == 200 );
+    }
+
+    std::cout << "count widths OK" << std::endl;
+}
+
+
+// copy and drop a pointer to one shared object from every thread
+template <class T>
+double copy_ns(int nthreads, int copies)
+{
+    typedef strong_ptr<T, std_mem_mgr<T>, typename ref_count_for<T, multi_thread_model>::type> pointer;
+    pointer shared(new T());
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t) {
+        threads.push_back(std::thread([&shared, copies]() {
+            for (int i = 0; i < copies; ++i) {
+                pointer copy(shared);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / copies;
+}
+
+// create and drop objects, one owner each
+template <class T>
+double lifetime_ns(int objects)
+{
+    typedef strong_ptr<T, std_mem_mgr<T>, typename ref_count_for<T, multi_thread_model>::type> pointer;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < objects; ++i) {
+        pointer p(new T());
+        pointer q(p);
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / objects;
+}
+
+template <class T>
+void bench(const char *name, int cores)
+{
+    printf("%-28s block %3zu bytes  copy 1 thread %6.2f ns  %2d threads %7.2f ns  create+drop %6.2f ns\n",
+        name, sizeof(typename ref_count_for<T, multi_thread_model>::type),
+        copy_ns<T>(1, 5000000), cores, copy_ns<T>(cores, 1000000), lifetime_ns<T>(2000000));
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_widths();
+
+    int cores = (int)std::thread::hardware_concurrency();
+    if (cores < 2) {
+        cores = 2;
+    }
+    bench<Plain>("int counts", cores);
+    bench<Wide>("64-bit counts", cores);
+    bench<Small>("16-bit saturating", cores);
+    bench<Packed>("packed int counts", cores);
+    bench<SmallPacked>("packed 16-bit saturating", cores);
+    return 0;
+}
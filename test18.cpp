@@ -0,0 +1,179 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <assert.h>
+#include "smart_ptr.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+namespace {
+    int Freed = 0;
+}
+
+template<typename T>
+class counting_mem_mgr {
+public:
+    static void deallocate(T *p) { ++Freed; delete p; }
+};
+
+struct Config
+{
+    Config() : retries(3), timeout_ms(250) {}
+    virtual ~Config() {}
+    int retries;
+    int timeout_ms;
+};
+
+struct TunedConfig : public Config
+{
+};
+
+typedef strong_ptr<Config, counting_mem_mgr<Config>, mt_ref_count> ConfigPtr;
+typedef weak_ptr<Config, counting_mem_mgr<Config>, mt_ref_count> ConfigWeakPtr;
+typedef strong_ptr<TunedConfig, counting_mem_mgr<TunedConfig>, mt_ref_count> TunedConfigPtr;
+
+// runs during dynamic initialization, before the definitions below in this file
+struct early_reader
+{
+    early_reader() : seen(Default_config().get()), count(Default_config().use_count()) {}
+    static const ConfigPtr & Default_config();
+    Config *seen;
+    int count;
+};
+early_reader Early;
+
+Config Default_config_object;
+// constant initialization: ready before any constructor of this program runs
+const ConfigPtr Default_config(immortal_tag(), &Default_config_object);
+
+const ConfigPtr & early_reader::Default_config()
+{
+    return ::Default_config;
+}
+
+// the single threaded counter is fine here, an immortal block is never written
+strong_ptr<std::string> Empty_name(immortal_tag(), new std::string());
+
+void test_immortal(void)
+{
+#if defined(__cplusplus) && __cplusplus >= 201103L
+    ASSERT( Early.seen == &Default_config_object && Early.count == INT_MAX );
+#endif
+    ASSERT( Default_config.immortal() && Default_config->retries == 3 );
+
+    ConfigPtr a = Default_config;
+    ConfigPtr b(a);
+    ASSERT( a.get() == &Default_config_object && a.use_count() == INT_MAX && !a.unique() );
+    ASSERT( a.get_counter() == Default_config.get_counter() );
+
+    ConfigWeakPtr w(a);
+    ASSERT( !w.expired() && w.lock().get() == a.get() && w.lock().immortal() );
+    a.reset();
+    b.reset();
+    w.reset();
+    ASSERT( Freed == 0 && Default_config.immortal() );
+
+    // converted pointers stay immortal, promoted borrows too
+    static TunedConfig tuned;
+    TunedConfigPtr t(immortal_tag(), &tuned);
+    ConfigPtr base = t;
+    ASSERT( base.immortal() && base->timeout_ms == 250 );
+    strong_ref<Config, counting_mem_mgr<Config>, mt_ref_count> r(base);
+    ASSERT( r.promote().immortal() );
+    base.reset();
+    t.reset();
+    ASSERT( Freed == 0 );
+
+    // copies from many threads, with the non-atomic default counter
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.push_back(std::thread([]() {
+            for (int k = 0; k < 10000; ++k) {
+                strong_ptr<std::string> copy = Empty_name;
+                ASSERT( copy->empty() );
+            }
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    ASSERT( Empty_name.use_count() == INT_MAX );
+
+    // ordinary pointers are unaffected
+    ConfigPtr normal(new Config());
+    ASSERT( !normal.immortal() && normal.unique() );
+    normal.reset();
+    ASSERT( Freed == 1 );
+
+    std::cout << "immortal strong_ptr OK" << std::endl;
+}
+
+
+// every request copies the global default config, reads it and drops the copy
+template <typename pointer>
+double ns_per_copy(const pointer &global, int nthreads, int copies)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t) {
+        threads.push_back(std::thread([&global, copies]() {
+            long sum = 0;
+            for (int i = 0; i < copies; ++i) {
+                pointer copy = global;
+                sum += copy->retries;
+            }
+            ASSERT( sum == 3L * copies );
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / copies;
+}
+
+struct SaturatedConfig : public Config {};
+namespace smart_ptr {
+    template <> struct ref_count_width<SaturatedConfig> { typedef small_counts type; };
+}
+typedef strong_ptr<SaturatedConfig, std_mem_mgr<SaturatedConfig>, ref_count_for<SaturatedConfig, multi_thread_model>::type> SaturatedPtr;
+
+void bench(int nthreads, int copies)
+{
+    ConfigPtr counted(new Config());
+    // a sticky count pushed past saturation, copies only read the block
+    SaturatedPtr saturated(new SaturatedConfig());
+    for (int i = 0; i < 20000; ++i) {
+        saturated.get_counter()->inc_ref();
+    }
+    double c = ns_per_copy(counted, nthreads, copies);
+    double s = ns_per_copy(saturated, nthreads, copies);
+    double i = ns_per_copy(Default_config, nthreads, copies);
+    printf("%2d threads copying a hot global: counted %8.2f ns  saturated %6.2f ns  immortal %6.2f ns\n",
+        nthreads, c, s, i);
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_immortal();
+
+    int cores = (int)std::thread::hardware_concurrency();
+    int max_threads = std::max(cores, 4);
+    for (int t = 1; t <= max_threads; t *= 2) {
+        bench(t, 2000000);
+    }
+    return 0;
+}
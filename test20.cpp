@@ -0,0 +1,247 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <utility>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "foreign_ptr.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+#if defined(_MSC_VER)
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// a C library with its own reference counting, as seen through its header
+
+struct frame_buffer
+{
+    std::atomic<int> refs;
+    size_t size;
+    unsigned char *data;
+};
+
+namespace {
+    std::atomic<int> Buffers_live(0);
+}
+
+NOINLINE frame_buffer * frame_buffer_new(size_t size)
+{
+    frame_buffer *b = (frame_buffer *)malloc(sizeof(frame_buffer));
+    new (&b->refs) std::atomic<int>(1);
+    b->size = size;
+    b->data = (unsigned char *)calloc(size, 1);
+    ++Buffers_live;
+    return b;
+}
+
+NOINLINE frame_buffer * frame_buffer_ref(frame_buffer *b)
+{
+    b->refs.fetch_add(1, std::memory_order_relaxed);
+    return b;
+}
+
+NOINLINE void frame_buffer_unref(frame_buffer *b)
+{
+    if (b->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        free(b->data);
+        free(b);
+        --Buffers_live;
+    }
+}
+
+NOINLINE int frame_buffer_refcount(const frame_buffer *b)
+{
+    return b->refs.load(std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+namespace smart_ptr {
+    template <> struct foreign_ref_traits<frame_buffer> {
+        static void add_ref(frame_buffer *p) { frame_buffer_ref(p); }
+        static void release(frame_buffer *p) { frame_buffer_unref(p); }
+    };
+}
+
+typedef foreign_ptr<frame_buffer> BufferPtr;
+
+// the double counted way: a counter block next to the library's count
+template<typename T>
+class buffer_mem_mgr {
+public:
+    static void deallocate(T *p) { frame_buffer_unref(p); }
+};
+typedef strong_ptr<frame_buffer, buffer_mem_mgr<frame_buffer>, mt_ref_count> WrappedBufferPtr;
+
+// COM style members work with the default traits
+struct Unknown
+{
+    Unknown() : refs(1) {}
+    void AddRef() { ++refs; }
+    void Release() { if (--refs == 0) delete this; }
+    int refs;
+};
+
+void test_foreign(void)
+{
+    {
+        BufferPtr a(adopt_ref_tag(), frame_buffer_new(64));
+        ASSERT( frame_buffer_refcount(a.get()) == 1 );   // adopted, not counted twice
+        BufferPtr b(a);
+        BufferPtr c;
+        c = b;
+        ASSERT( frame_buffer_refcount(a.get()) == 3 && b == a && c == a );
+
+        BufferPtr d(a.get());                               // a new reference to a borrowed handle
+        ASSERT( frame_buffer_refcount(a.get()) == 4 );
+
+#if SMART_PTR_HAS_RVALUE_REFS
+        BufferPtr moved(std::move(d));
+        ASSERT( frame_buffer_refcount(a.get()) == 4 && d.get() == 0 );
+        moved = std::move(c);
+        ASSERT( frame_buffer_refcount(a.get()) == 3 && c.get() == 0 );
+#endif  // SMART_PTR_HAS_RVALUE_REFS
+
+        BufferPtr other(adopt_ref_tag(), frame_buffer_new(16));
+        b.swap(other);
+        ASSERT( b->size == 16 && other == a );
+        b.reset(a.get());
+        ASSERT( Buffers_live == 1 && frame_buffer_refcount(a.get()) >= 3 );
+
+        // hand a reference to C code that takes it over
+        frame_buffer *raw = b.detach();
+        ASSERT( b.get() == 0 );
+        frame_buffer_unref(raw);
+
+        std::vector<BufferPtr> many(100, a);
+        ASSERT( frame_buffer_refcount(a.get()) >= 102 );
+        many.clear();
+        b.reset(adopt_ref_tag(), frame_buffer_new(8));
+        ASSERT( Buffers_live == 2 );
+        ASSERT( sizeof(BufferPtr) == sizeof(frame_buffer *) );
+    }
+    ASSERT( Buffers_live == 0 );
+
+    {
+        foreign_ptr<Unknown> u(adopt_ref_tag(), new Unknown());
+        foreign_ptr<Unknown> v = u;
+        ASSERT( u->refs == 2 );
+        v.reset();
+        ASSERT( u->refs == 1 );
+    }
+
+    // copies from many threads, counted by the library only
+    {
+        BufferPtr shared(adopt_ref_tag(), frame_buffer_new(64));
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.push_back(std::thread([shared]() {
+                for (int i = 0; i < 10000; ++i) {
+                    BufferPtr copy = shared;
+                    ASSERT( copy->size == 64 );
+                }
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); ++t) {
+            threads[t].join();
+        }
+        ASSERT( frame_buffer_refcount(shared.get()) == 1 );
+    }
+    ASSERT( Buffers_live == 0 );
+
+    std::cout << "foreign_ptr OK" << std::endl;
+}
+
+
+template <typename fn>
+double ns_per(int n, fn f)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+}
+
+template <typename pointer>
+void bench(const char *name, pointer (*wrap)(frame_buffer *), int cores)
+{
+    const int n = 1000000;
+    // wrap a handle fresh from the library, copy it once, drop both
+    double wrap_ns = ns_per(n, [wrap]() {
+        for (int i = 0; i < n; ++i) {
+            pointer p = wrap(frame_buffer_new(16));
+            pointer q(p);
+        }
+    });
+
+    pointer shared = wrap(frame_buffer_new(16));
+    double copy_ns = ns_per(n, [&shared]() {
+        for (int i = 0; i < n; ++i) {
+            pointer copy(shared);
+        }
+    });
+    double shared_ns = ns_per(n, [&shared, cores]() {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < cores; ++t) {
+            threads.push_back(std::thread([&shared]() {
+                for (int i = 0; i < n; ++i) {
+                    pointer copy(shared);
+                }
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); ++t) {
+            threads[t].join();
+        }
+    });
+
+    // a cache of handles, one pointer each
+    std::vector<pointer> cache;
+    cache.reserve(n);
+    double fill_ns = ns_per(n, [&cache, wrap]() {
+        for (int i = 0; i < n; ++i) {
+            cache.push_back(wrap(frame_buffer_new(16)));
+        }
+    });
+    cache.clear();
+
+    printf("%-22s %2zu bytes/ptr  wrap+copy+drop %7.2f ns  copy %6.2f ns  %d threads %7.2f ns  fill cache %7.2f ns\n",
+        name, sizeof(pointer), wrap_ns, copy_ns, cores, shared_ns, fill_ns);
+}
+
+BufferPtr wrap_foreign(frame_buffer *b)
+{
+    return BufferPtr(adopt_ref_tag(), b);
+}
+
+WrappedBufferPtr wrap_double(frame_buffer *b)
+{
+    return WrappedBufferPtr(b);
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_foreign();
+
+    int cores = std::max((int)std::thread::hardware_concurrency(), 2);
+    bench("foreign_ptr", &wrap_foreign, cores);
+    bench("strong_ptr + ref_count", &wrap_double, cores);
+    ASSERT( Buffers_live == 0 );
+    return 0;
+}
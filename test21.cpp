@@ -0,0 +1,487 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "smart_ptr.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+//////////////////////////////////////////////////////////////////////////
+//
+//   Stress harness for the multi-threaded counts: threads run a random
+//   mix of create, copy, reset, weaken, lock, expired and cross-thread
+//   handoff on a small set of shared objects, then the books are checked.
+//   Objects and counter blocks carry a state word and go to a per-thread
+//   quarantine instead of the heap when freed, so a second free or a read
+//   through a dangling strong_ptr shows up as a state error rather than as
+//   heap corruption. Run with [threads] [milliseconds per mix] [mix name
+//   or nine comma separated weights]; every mix doubles as a contention
+//   benchmark.
+//
+
+enum { state_unbound = 0, state_alive = 0x5eed, state_dead = 0xdead };
+
+namespace {
+    std::atomic<long> Created(0), Destroyed(0);
+    std::atomic<long> Blocks_created(0), Blocks_deleted(0);
+    std::atomic<long> Double_free(0), Use_after_free(0), Lock_after_expired(0), Bad_count(0), Double_delete(0);
+}
+
+// freed memory is held back for a while so dangling reads find state_dead
+class quarantine
+{
+public:
+    enum { slots = 4096 };
+
+    quarantine() : m_next(0)
+    {
+        memset(m_ring, 0, sizeof(m_ring));
+    }
+
+    ~quarantine()
+    {
+        for (size_t i = 0; i < slots; ++i) {
+            ::operator delete(m_ring[i]);
+        }
+    }
+
+    static void retire(void *p)
+    {
+        static thread_local quarantine local;
+        ::operator delete(local.m_ring[local.m_next]);
+        local.m_ring[local.m_next] = p;
+        local.m_next = (local.m_next + 1) % slots;
+    }
+
+private:
+    void *m_ring[slots];
+    size_t m_next;
+};
+
+struct Tracked
+{
+    explicit Tracked(unsigned _id) : state(state_alive), id(_id), check(~_id) { ++Created; }
+    std::atomic<int> state;
+    unsigned id;
+    unsigned check;
+};
+
+template<typename T>
+class checking_mem_mgr {
+public:
+    static void deallocate(T *p)
+    {
+        if (p->state.exchange(state_dead) != state_alive) {
+            ++Double_free;
+            return;
+        }
+        ++Destroyed;
+        p->~T();
+        quarantine::retire(p);
+    }
+};
+
+// a counter block that notices being deleted twice; the immortal block of
+// this type is never bound and not counted
+template <typename layout>
+class checked_ref_count : public basic_ref_count<multi_thread_model, layout>
+{
+public:
+    checked_ref_count() : m_state(state_unbound)
+    {
+    }
+
+    ~checked_ref_count()
+    {
+        int state = m_state.exchange(state_dead);
+        if (state == state_dead) {
+            ++Double_delete;
+        } else if (state == state_alive) {
+            ++Blocks_deleted;
+        }
+    }
+
+    template <class T, typename mem_mgr>
+    void bind(T *)
+    {
+        m_state = state_alive;
+        ++Blocks_created;
+    }
+
+    static void * operator new(size_t size) { return ::operator new(size); }
+    static void operator delete(void *p)    { quarantine::retire(p); }
+
+private:
+    std::atomic<int> m_state;
+};
+
+// random op mixes
+enum op { op_create, op_copy, op_reset, op_weaken, op_lock, op_expired, op_handoff, op_handoff_weak, op_read, op_count };
+
+struct mix
+{
+    const char *name;
+    int weights[op_count];
+};
+
+template <typename layout>
+struct harness
+{
+    typedef checked_ref_count<layout> counter;
+    typedef strong_ptr<Tracked, checking_mem_mgr<Tracked>, counter> TrackedPtr;
+    typedef weak_ptr<Tracked, checking_mem_mgr<Tracked>, counter> TrackedWeakPtr;
+
+    static bool readable(const TrackedPtr &p)
+    {
+        if (!p.get()) {
+            return true;
+        }
+        if (p->state.load(std::memory_order_relaxed) != state_alive || p->check != ~p->id) {
+            ++Use_after_free;
+            return false;
+        }
+        if (p.use_count() < 1) {
+            ++Bad_count;
+        }
+        return true;
+    }
+
+    // pointers move between threads through these, a spin lock only guards the swap
+    struct slot
+    {
+        slot() { busy.clear(); }
+        std::atomic_flag busy;
+        TrackedPtr strong;
+        TrackedWeakPtr weak;
+    };
+
+    enum { locals = 8, shared_slots = 64 };
+
+    static slot * slots()
+    {
+        static slot all[shared_slots];
+        return all;
+    }
+
+    static void lock_slot(slot &s)
+    {
+        while (s.busy.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+    static void unlock_slot(slot &s)
+    {
+        s.busy.clear(std::memory_order_release);
+    }
+
+    static void worker(const mix &m, unsigned seed, std::atomic<bool> &stop, long &ops)
+    {
+        TrackedPtr strong[locals];
+        TrackedWeakPtr weak[locals];
+        int total = 0;
+        for (int i = 0; i < op_count; ++i) {
+            total += m.weights[i];
+        }
+        unsigned x = seed * 2654435761u + 1;
+        long done = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+            for (int n = 0; n < 256; ++n, ++done) {
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                int pick = (int)(x % (unsigned)total);
+                int o = 0;
+                while (pick >= m.weights[o]) {
+                    pick -= m.weights[o++];
+                }
+                int i = (x >> 8) % locals, j = (x >> 12) % locals;
+                switch (o) {
+                case op_create:
+                    strong[i].reset(new Tracked(x));
+                    break;
+                case op_copy:
+                    strong[i] = strong[j];
+                    if (strong[i].get() != strong[j].get()) {
+                        ++Bad_count;
+                    }
+                    readable(strong[i]);
+                    break;
+                case op_reset:
+                    strong[i].reset();
+                    break;
+                case op_weaken:
+                    weak[i] = strong[j];
+                    break;
+                case op_lock:
+                    {
+                        bool was_expired = weak[i].expired();
+                        TrackedPtr p = weak[i].lock();
+                        if (p.get() && was_expired) {
+                            ++Lock_after_expired;
+                        }
+                        readable(p);
+                    }
+                    break;
+                case op_expired:
+                    if (weak[i].expired() && weak[i].lock().get()) {
+                        ++Lock_after_expired;
+                    }
+                    break;
+                case op_handoff:
+                    {
+                        slot &s = slots()[(x >> 16) % shared_slots];
+                        lock_slot(s);
+                        strong[i].swap(s.strong);
+                        unlock_slot(s);
+                        readable(strong[i]);
+                    }
+                    break;
+                case op_handoff_weak:
+                    {
+                        slot &s = slots()[(x >> 16) % shared_slots];
+                        lock_slot(s);
+                        weak[i].swap(s.weak);
+                        unlock_slot(s);
+                    }
+                    break;
+                default:
+                    readable(strong[i]);
+                    break;
+                }
+            }
+        }
+        ops = done;
+    }
+
+    static double run_mix(const mix &m, int nthreads, int ms)
+    {
+        std::atomic<bool> stop(false);
+        std::vector<long> ops(nthreads, 0);
+        std::vector<std::thread> threads;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for (int t = 0; t < nthreads; ++t) {
+            threads.push_back(std::thread(&harness::worker, std::cref(m), (unsigned)t + 1, std::ref(stop), std::ref(ops[t])));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        stop = true;
+        for (size_t t = 0; t < threads.size(); ++t) {
+            threads[t].join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        for (int s = 0; s < shared_slots; ++s) {
+            slots()[s].strong.reset();
+            slots()[s].weak.reset();
+        }
+        long sum = 0;
+        for (int t = 0; t < nthreads; ++t) {
+            sum += ops[t];
+        }
+        return sum / seconds / 1e6;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // targeted races: two threads run one step each against prepared
+    // pointers, and the result has to match one of the orders the two
+    // steps could have been serialized in
+
+    struct race
+    {
+        race() : generation(0), finished(0), quit(false) {}
+
+        std::atomic<int> generation;
+        std::atomic<int> finished;
+        std::atomic<bool> quit;
+        std::function<void()> step[2];
+
+        void side(int who)
+        {
+            int seen = 0;
+            for (;;) {
+                while (generation.load(std::memory_order_acquire) == seen) {
+                    if (quit.load(std::memory_order_relaxed)) {
+                        return;
+                    }
+                    std::this_thread::yield();
+                }
+                ++seen;
+                step[who]();
+                ++finished;
+            }
+        }
+
+        void go()
+        {
+            finished = 0;
+            ++generation;
+            while (finished.load(std::memory_order_acquire) != 2) {
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    static void races(int rounds, long outcomes[2])
+    {
+        race r;
+        std::thread a(&race::side, &r, 0), b(&race::side, &r, 1);
+        TrackedPtr s1, s2, got;
+        TrackedWeakPtr w;
+        outcomes[0] = outcomes[1] = 0;
+
+        // lock() while the last strong owner lets go: either lock wins and
+        // frees on its own release, or it gets nothing; freed exactly once
+        r.step[0] = [&]() { s1.reset(); };
+        r.step[1] = [&]() { got = w.lock(); readable(got); };
+        for (int i = 0; i < rounds; ++i) {
+            s1.reset(new Tracked(i));
+            w = s1;
+            long destroyed = Destroyed;
+            r.go();
+            ++outcomes[got.get() ? 0 : 1];
+            ASSERT( Destroyed == destroyed + (got.get() ? 0 : 1) );
+            got.reset();
+            ASSERT( Destroyed == destroyed + 1 && w.expired() && !w.lock().get() );
+            w.reset();
+        }
+
+        // copying one owner while another resets: the count ends at 2
+        r.step[0] = [&]() { got = s1; };
+        r.step[1] = [&]() { s2.reset(); };
+        for (int i = 0; i < rounds; ++i) {
+            s1.reset(new Tracked(i));
+            s2 = s1;
+            r.go();
+            ASSERT( s1.use_count() == 2 && got.get() == s1.get() );
+            long destroyed = Destroyed;
+            got.reset();
+            s1.reset();
+            ASSERT( Destroyed == destroyed + 1 );
+        }
+
+        // two owners drop at once: exactly one frees
+        r.step[0] = [&]() { s1.reset(); };
+        r.step[1] = [&]() { s2.reset(); };
+        for (int i = 0; i < rounds; ++i) {
+            s1.reset(new Tracked(i));
+            s2 = s1;
+            long destroyed = Destroyed;
+            r.go();
+            ASSERT( Destroyed == destroyed + 1 );
+        }
+
+        // the last strong and the last weak reference drop at once: the
+        // block goes exactly once
+        r.step[0] = [&]() { s1.reset(); };
+        r.step[1] = [&]() { w.reset(); };
+        for (int i = 0; i < rounds; ++i) {
+            s1.reset(new Tracked(i));
+            w = s1;
+            long deleted = Blocks_deleted;
+            r.go();
+            ASSERT( Blocks_deleted == deleted + 1 );
+        }
+
+        r.quit = true;
+        a.join();
+        b.join();
+    }
+
+    static void check_books(const char *what)
+    {
+        long errors = Double_free + Use_after_free + Lock_after_expired + Bad_count + Double_delete;
+        if (errors || Created != Destroyed || Blocks_created != Blocks_deleted) {
+            printf("%s: created %ld destroyed %ld, blocks %ld/%ld, double free %ld, use after free %ld, "
+                "lock after expired %ld, bad count %ld, double delete %ld\n",
+                what, Created.load(), Destroyed.load(), Blocks_created.load(), Blocks_deleted.load(),
+                Double_free.load(), Use_after_free.load(), Lock_after_expired.load(), Bad_count.load(), Double_delete.load());
+        }
+        ASSERT( errors == 0 );
+        ASSERT( Created == Destroyed && Blocks_created == Blocks_deleted );
+    }
+
+    static void run(const char *name, const std::vector<mix> &mixes, int nthreads, int ms, int rounds)
+    {
+        long outcomes[2];
+        races(rounds, outcomes);
+        check_books(name);
+        printf("%-8s races: %d rounds each, lock won %ld, release won %ld\n", name, rounds, outcomes[0], outcomes[1]);
+
+        for (size_t i = 0; i < mixes.size(); ++i) {
+            double mops = run_mix(mixes[i], nthreads, ms);
+            check_books(mixes[i].name);
+            printf("%-8s %-10s %2d threads %8.2f Mops/s\n", name, mixes[i].name, nthreads, mops);
+        }
+    }
+};
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main(int argc, char **argv)
+{
+    //                       create copy reset weaken lock expired handoff handoff_weak read
+    static const mix all[] = {
+        { "balanced",   {  10,   20,   10,    10,    15,     5,      10,         5,      15 } },
+        { "copy",       {   2,   50,    5,     0,     0,     0,       3,         0,      40 } },
+        { "lock",       {   5,    5,    5,    15,    40,    20,       5,         5,       0 } },
+        { "churn",      {  30,   10,   30,    10,    10,     0,      10,         0,       0 } },
+        { "handoff",    {  10,   10,    5,     5,    10,     0,      40,        20,       0 } },
+    };
+    int nthreads = std::max((int)std::thread::hardware_concurrency(), 4);
+    int ms = 200;
+    int rounds = 20000;
+    std::vector<mix> mixes(all, all + sizeof(all) / sizeof(all[0]));
+
+    if (argc > 1) {
+        nthreads = std::max(atoi(argv[1]), 1);
+    }
+    if (argc > 2) {
+        ms = std::max(atoi(argv[2]), 1);
+    }
+    if (argc > 3) {
+        std::vector<mix> chosen;
+        for (size_t i = 0; i < mixes.size(); ++i) {
+            if (strcmp(argv[3], mixes[i].name) == 0) {
+                chosen.push_back(mixes[i]);
+            }
+        }
+        if (chosen.empty()) {
+            mix custom = { "custom", { 0 } };
+            const char *p = argv[3];
+            for (int i = 0; i < op_count && *p; ++i) {
+                custom.weights[i] = std::max(atoi(p), 0);
+                p = strchr(p, ',');
+                p = p ? p + 1 : "";
+            }
+            int total = 0;
+            for (int i = 0; i < op_count; ++i) {
+                total += custom.weights[i];
+            }
+            if (total == 0) {
+                printf("usage: %s [threads] [milliseconds per mix] [mix name | %d weights]\n", argv[0], (int)op_count);
+                return 1;
+            }
+            chosen.push_back(custom);
+        }
+        mixes = chosen;
+    }
+
+    harness<compact_layout>::run("compact", mixes, nthreads, ms, rounds);
+    harness<packed_layout>::run("packed", mixes, nthreads, ms, rounds);
+    std::cout << "ref_count stress OK" << std::endl;
+    return 0;
+}
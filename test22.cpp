@@ -0,0 +1,205 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <assert.h>
+#include "snapshot_ptr.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+namespace {
+    std::atomic<int> Tables_live(0);
+}
+
+// a routing table; every entry encodes the version so a torn read shows
+struct Table
+{
+    explicit Table(unsigned long long _version) : version(_version)
+    {
+        for (int i = 0; i < entries; ++i) {
+            route[i] = (unsigned)(_version * 31 + i);
+        }
+        ++Tables_live;
+    }
+    ~Table() { --Tables_live; }
+
+    bool consistent() const
+    {
+        for (int i = 0; i < entries; ++i) {
+            if (route[i] != (unsigned)(version * 31 + i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    unsigned lookup(unsigned key) const { return route[key % entries]; }
+
+    enum { entries = 16 };
+    unsigned long long version;
+    unsigned route[entries];
+};
+
+typedef snapshot_publisher<Table> TablePublisher;
+typedef make_strong_ptr<Table, std_mem_mgr<Table>, mt_ref_count> make_table;
+
+void test_snapshot(void)
+{
+    {
+        TablePublisher pub;
+        TablePublisher::reader r(pub);
+        ASSERT( pub.version() == 0 && r.get().get() == 0 );
+
+        pub.publish(make_table::generate(1ULL));
+        ASSERT( pub.version() == 1 && Tables_live == 1 );
+        ASSERT( r->version == 1 && r.version() == 1 );
+
+        // steady state: the reader's copy is the snapshot, nothing is copied again
+        const TablePublisher::pointer_type *held = &r.get();
+        ASSERT( &r.get() == held && r.get().use_count() == 2 );
+
+        // the old table lives on until the reader moves on
+        pub.publish(make_table::generate(2ULL));
+        ASSERT( Tables_live == 2 && pub.current()->version == 2 );
+        ASSERT( r->version == 2 && Tables_live == 1 );
+
+        TablePublisher::reader idle(pub);
+        ASSERT( idle->version == 2 );
+        pub.update([](const TablePublisher::pointer_type &cur) { return make_table::generate(cur->version + 1); });
+        ASSERT( pub.version() == 3 && Tables_live == 2 );
+        idle.release();
+        ASSERT( Tables_live == 2 );                 // r still holds version 2
+        ASSERT( r->version == 3 && Tables_live == 1 );
+    }
+    ASSERT( Tables_live == 0 );
+
+    // readers racing a writer: never a torn or older table, all old ones freed
+    {
+        TablePublisher pub(make_table::generate(1ULL));
+        std::atomic<bool> stop(false);
+        std::atomic<long> bad(0);
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 8; ++t) {
+            readers.push_back(std::thread([&pub, &stop, &bad]() {
+                TablePublisher::reader r(pub);
+                unsigned long long last = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    const Table &table = *r;
+                    if (!table.consistent() || table.version < last || table.version != r.version()) {
+                        ++bad;
+                    }
+                    last = table.version;
+                }
+            }));
+        }
+        for (unsigned long long v = 2; v <= 2000; ++v) {
+            pub.publish(make_table::generate(v));
+            if (v % 100 == 0) {
+                std::this_thread::yield();
+            }
+        }
+        stop = true;
+        for (size_t t = 0; t < readers.size(); ++t) {
+            readers[t].join();
+        }
+        ASSERT( bad == 0 && Tables_live == 1 && pub.current()->version == 2000 );
+    }
+    ASSERT( Tables_live == 0 );
+
+    std::cout << "snapshot_publisher OK" << std::endl;
+}
+
+
+// each reader times batches of reads; median, 99th percentile and mean per read
+template <typename read_fn>
+void latency(const char *name, int nthreads, int reads, read_fn read, TablePublisher *writer_pub)
+{
+    const int batch = 64;
+    std::vector<std::vector<double> > samples(nthreads);
+    std::atomic<bool> stop(false);
+    std::thread writer;
+    if (writer_pub) {
+        writer = std::thread([writer_pub, &stop]() {
+            unsigned long long v = writer_pub->version();
+            while (!stop.load(std::memory_order_relaxed)) {
+                writer_pub->publish(make_table::generate(++v));
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t) {
+        threads.push_back(std::thread([&samples, &read, t, reads]() {
+            std::vector<double> &mine = samples[t];
+            mine.reserve(reads / batch);
+            unsigned sum = 0;
+            for (int i = 0; i < reads; i += batch) {
+                std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                for (int k = 0; k < batch; ++k) {
+                    sum += read((unsigned)(i + k));
+                }
+                mine.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / batch);
+            }
+            ASSERT( sum != 1 );
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    stop = true;
+    if (writer_pub) {
+        writer.join();
+    }
+
+    std::vector<double> all;
+    for (int t = 0; t < nthreads; ++t) {
+        all.insert(all.end(), samples[t].begin(), samples[t].end());
+    }
+    std::sort(all.begin(), all.end());
+    double mean = 0;
+    for (size_t i = 0; i < all.size(); ++i) {
+        mean += all[i];
+    }
+    mean /= all.size();
+    printf("%-34s %2d threads  p50 %7.2f  p99 %7.2f  mean %8.2f ns/read\n",
+        name, nthreads, all[all.size() / 2], all[all.size() * 99 / 100], mean);
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_snapshot();
+
+    const int nthreads = 64;
+    const int reads = 100000;
+
+    // copying one global strong_ptr per read, no writer since that copy is not safe against one
+    TablePublisher::pointer_type global = make_table::generate(1ULL);
+    latency("copy global strong_ptr", nthreads, reads, [&global](unsigned key) {
+        TablePublisher::pointer_type table = global;
+        return table->lookup(key);
+    }, 0);
+
+    TablePublisher pub(make_table::generate(1ULL));
+    latency("publisher.current(), writer 1/ms", nthreads, reads, [&pub](unsigned key) {
+        return pub.current()->lookup(key);
+    }, &pub);
+
+    latency("thread_local reader, writer 1/ms", nthreads, reads, [&pub](unsigned key) {
+        static thread_local TablePublisher::reader r(pub);
+        return r->lookup(key);
+    }, &pub);
+    return 0;
+}
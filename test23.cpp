@@ -0,0 +1,281 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "pool_ptr.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+// a pool that remembers how many bytes went out and came back per size
+namespace {
+    std::atomic<long> Pool_out[512];
+    std::atomic<long> Pool_back[512];
+    std::atomic<int> Destructed[4];
+}
+
+class counting_pool
+{
+public:
+    enum { alignment = size_class_pool::alignment };
+
+    static void * allocate(size_t size)
+    {
+        ++Pool_out[size];
+        return size_class_pool::allocate(size);
+    }
+
+    static void deallocate(void *p, size_t size)
+    {
+        ++Pool_back[size];
+        size_class_pool::deallocate(p, size);
+    }
+};
+
+bool pool_balanced()
+{
+    for (int i = 0; i < 512; ++i) {
+        if (Pool_out[i] != Pool_back[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// constructed before the pool registers the thread, so destroyed after it closed
+struct late_user
+{
+    explicit late_user(size_t _size) : size(_size) {}
+    ~late_user() { size_class_pool::deallocate(size_class_pool::allocate(size), size); }
+    size_t size;
+};
+
+// no virtual destructor anywhere: the counter frees by the created type
+struct Shape
+{
+    explicit Shape(int _kind) : kind(_kind) {}
+    ~Shape() { ++Destructed[0]; }
+    int kind;
+};
+
+struct Circle : public Shape
+{
+    explicit Circle(double r) : Shape(1), radius(r) {}
+    ~Circle() { ++Destructed[1]; }
+    double radius;
+};
+
+struct Named
+{
+    Named() { strcpy(name, "label"); }
+    char name[40];
+};
+
+// Shape is not the first base, its subobject is not at the start
+struct Label : public Named, public Shape
+{
+    Label() : Shape(2) { memset(text, 'x', sizeof(text)); }
+    ~Label() { ++Destructed[2]; }
+    char text[100];
+};
+
+template <class T> struct counted { typedef strong_ptr<T, pool_mem_mgr<T, counting_pool>, allocation_ref_count<> > ptr; };
+typedef counted<Shape>::ptr ShapePtr;
+typedef counted<Circle>::ptr CirclePtr;
+typedef counted<Label>::ptr LabelPtr;
+typedef weak_ptr<Shape, pool_mem_mgr<Shape, counting_pool>, allocation_ref_count<> > ShapeWeakPtr;
+
+void test_pool(void)
+{
+    {
+        ShapePtr s = make_strong_ptr<Circle, pool_mem_mgr<Circle, counting_pool>, allocation_ref_count<> >::generate(2.0);
+        ASSERT( s->kind == 1 && Pool_out[sizeof(Circle)] == 1 );
+        ASSERT( s.get_counter()->allocated_size() == sizeof(Circle) );
+        typedef allocation_source_of<Circle, pool_mem_mgr<Circle, counting_pool> > circle_source;
+        ASSERT( s.get_counter()->source() == &circle_source::source );
+
+        // back down to the derived type and drop the original last
+        CirclePtr c(s);
+        ASSERT( c->radius == 2.0 && c.use_count() == 2 );
+        c.reset();
+        ShapeWeakPtr w(s);
+        s.reset();
+        ASSERT( w.expired() );
+        ASSERT( Pool_back[sizeof(Circle)] == 1 && Pool_back[sizeof(Shape)] == 0 );
+        ASSERT( Destructed[1] == 1 && Destructed[0] == 1 );
+    }
+
+    {
+        LabelPtr l(counted<Label>::ptr(pool_mem_mgr<Label, counting_pool>::allocate()));
+        ShapePtr s(l);
+        ASSERT( (void *)s.get() != (void *)l.get() && s->kind == 2 );
+        l.reset();
+        s.reset();                                  // freed from the Shape subobject
+        ASSERT( Destructed[2] == 1 && Pool_back[sizeof(Label)] == 1 );
+    }
+
+    // the mem_mgr of the static type alone would get it wrong, as shown by the sizes
+    ASSERT( sizeof(Circle) != sizeof(Shape) && sizeof(Label) != sizeof(Shape) );
+    ASSERT( pool_balanced() );
+
+    // mixed types handed between threads and freed there through the base
+    {
+        std::vector<ShapePtr> shapes;
+        for (int i = 0; i < 3000; ++i) {
+            if (i % 2) {
+                shapes.push_back(make_strong_ptr<Circle, pool_mem_mgr<Circle, counting_pool>, allocation_ref_count<> >::generate((double)i));
+            } else {
+                shapes.push_back(LabelPtr(pool_mem_mgr<Label, counting_pool>::allocate()));
+            }
+        }
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 3; ++t) {
+            std::vector<ShapePtr> part(shapes.begin() + t * 1000, shapes.begin() + (t + 1) * 1000);
+            threads.push_back(std::thread([part]() mutable {
+                for (size_t i = 0; i < part.size(); ++i) {
+                    ASSERT( part[i]->kind == 1 || part[i]->kind == 2 );
+                }
+                part.clear();
+            }));
+        }
+        shapes.clear();
+        for (size_t t = 0; t < threads.size(); ++t) {
+            threads[t].join();
+        }
+        ASSERT( pool_balanced() );
+    }
+
+    // a thread_local destructor allocating after the pool's lists closed
+    // must not take the global list with it
+    {
+        const size_t size = 200;                    // a class nothing else here uses
+        std::vector<void *> spilled;
+        std::thread([&spilled, size]() {
+            for (int i = 0; i < 10; ++i) {
+                spilled.push_back(size_class_pool::allocate(size));
+            }
+            for (size_t i = 0; i < spilled.size(); ++i) {
+                size_class_pool::deallocate(spilled[i], size);
+            }
+        }).join();
+        std::thread([size]() {
+            static thread_local late_user late(size);
+            size_class_pool::deallocate(size_class_pool::allocate(16), 16);
+        }).join();
+        std::thread([&spilled, size]() {
+            std::vector<void *> got;
+            const int chunk_blocks = size_class_pool::chunk_size / 208;   // the 200 byte class
+            for (int i = 0; i < chunk_blocks; ++i) {
+                got.push_back(size_class_pool::allocate(size));
+            }
+            for (size_t i = 0; i < spilled.size(); ++i) {
+                ASSERT( std::find(got.begin(), got.end(), spilled[i]) != got.end() );
+            }
+            for (size_t i = 0; i < got.size(); ++i) {
+                size_class_pool::deallocate(got[i], size);
+            }
+        }).join();
+    }
+
+    // the default pool and the make_pool_ptr shorthand
+    {
+        pool_strong_ptr<Shape> s = make_pool_ptr<Circle>::generate(1.5);
+        pool_weak_ptr<Shape> w = s;
+        ASSERT( !w.expired() && w.lock()->kind == 1 );
+        s.reset();
+        ASSERT( w.expired() );
+    }
+
+    std::cout << "pool_strong_ptr OK" << std::endl;
+}
+
+
+// a virtual hierarchy for the comparison with new/delete
+struct Node
+{
+    Node() : hits(0) {}
+    virtual ~Node() {}
+    virtual int weight() const = 0;
+    int hits;
+};
+
+template <int bytes>
+struct Leaf : public Node
+{
+    virtual int weight() const { return bytes; }
+    char payload[bytes];
+};
+
+typedef strong_ptr<Node, std_mem_mgr<Node>, mt_ref_count> HeapNodePtr;
+typedef pool_strong_ptr<Node> PoolNodePtr;
+
+template <class T>
+HeapNodePtr make_heap() { return HeapNodePtr(new T()); }
+
+template <class T>
+PoolNodePtr make_pooled() { return make_pool_ptr<T>::generate(); }
+
+// a random mix of five leaf sizes, kept through the base, dropped in another order
+template <typename pointer>
+double churn_ns(pointer (*const make[5])(), int objects, int rounds)
+{
+    std::vector<pointer> live(objects);
+    unsigned x = 12345;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < objects; ++i) {
+            x = x * 1103515245 + 12345;
+            live[(x >> 8) % objects] = make[(x >> 4) % 5]();
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    return ns / ((double)objects * rounds);
+}
+
+template <typename pointer>
+double threaded_churn_ns(pointer (*const make[5])(), int nthreads, int objects, int rounds)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t) {
+        threads.push_back(std::thread([make, objects, rounds]() { churn_ns<pointer>(make, objects, rounds); }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    return ns / ((double)objects * rounds * nthreads);
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_pool();
+
+    static HeapNodePtr (*const heap[5])() = { &make_heap<Leaf<8> >, &make_heap<Leaf<24> >, &make_heap<Leaf<56> >, &make_heap<Leaf<120> >, &make_heap<Leaf<200> > };
+    static PoolNodePtr (*const pooled[5])() = { &make_pooled<Leaf<8> >, &make_pooled<Leaf<24> >, &make_pooled<Leaf<56> >, &make_pooled<Leaf<120> >, &make_pooled<Leaf<200> > };
+    const int objects = 10000, rounds = 200;
+    int nthreads = std::max((int)std::thread::hardware_concurrency(), 4);
+
+    printf("counter block: mt_ref_count %zu bytes, allocation_ref_count %zu bytes\n",
+        sizeof(mt_ref_count), sizeof(allocation_ref_count<>));
+    printf("replace a random one of %d mixed objects, 1 thread:   new/delete %6.2f ns  pool %6.2f ns\n",
+        objects, churn_ns<HeapNodePtr>(heap, objects, rounds), churn_ns<PoolNodePtr>(pooled, objects, rounds));
+    printf("replace a random one of %d mixed objects, %d threads: new/delete %6.2f ns  pool %6.2f ns\n",
+        objects, nthreads, threaded_churn_ns<HeapNodePtr>(heap, nthreads, objects, rounds / 4),
+        threaded_churn_ns<PoolNodePtr>(pooled, nthreads, objects, rounds / 4));
+    return 0;
+}
@@ -0,0 +1,256 @@
+#include <iostream>
+#include <deque>
+#include <functional>
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "coro_ptr.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+// the first allocation after Measuring is set is the coroutine frame
+namespace {
+    bool Measuring = false;
+    size_t Frame_size = 0;
+    long Count_ops = 0;
+    int Sessions_live = 0;
+    int Guards_destroyed = 0;
+}
+
+// GCC sees the free() of a replaced operator new as a mismatch once both are inlined
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+# pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void * operator new(size_t size)
+{
+    if (Measuring) {
+        Measuring = false;
+        Frame_size = size;
+    }
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// counts every strong count update
+class counting_ref_count : public basic_ref_count<multi_thread_model>
+{
+    typedef basic_ref_count<multi_thread_model> baseClass;
+public:
+    int inc_ref()               { ++Count_ops; return baseClass::inc_ref(); }
+    bool inc_ref_if_alive()     { ++Count_ops; return baseClass::inc_ref_if_alive(); }
+    int dec_ref()               { ++Count_ops; return baseClass::dec_ref(); }
+};
+
+struct Session
+{
+    Session() : bytes(0) { ++Sessions_live; }
+    ~Session() { --Sessions_live; }
+    long bytes;
+};
+
+typedef strong_ptr<Session, std_mem_mgr<Session>, counting_ref_count> SessionPtr;
+typedef strong_ref<Session, std_mem_mgr<Session>, counting_ref_count> SessionRef;
+typedef owned_task<Session, std_mem_mgr<Session>, counting_ref_count> SessionTask;
+
+// completions run one after another, like an io loop
+struct event_loop
+{
+    void post(std::function<void()> f)
+    {
+        queue.push_back(std::move(f));
+    }
+
+    void run()
+    {
+        while (!queue.empty()) {
+            std::function<void()> f = std::move(queue.front());
+            queue.pop_front();
+            f();
+        }
+    }
+
+    std::deque<std::function<void()> > queue;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// the usual way: a detached task, awaiters and callbacks copy the pointer
+
+struct plain_task
+{
+    struct promise_type
+    {
+        plain_task get_return_object()              { return plain_task(); }
+        std::suspend_never initial_suspend()        { return std::suspend_never(); }
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+        void return_void()                          {}
+        void unhandled_exception()                  { std::terminate(); }
+    };
+};
+
+struct read_awaiter
+{
+    SessionPtr s;
+    event_loop &loop;
+
+    bool await_ready() const    { return false; }
+    void await_resume() const   {}
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        SessionPtr session = s;
+        loop.post([session, h]() { session->bytes += 1; h.resume(); });
+    }
+};
+
+plain_task plain_serve(SessionPtr s, event_loop &loop, int reads)
+{
+    for (int i = 0; i < reads; ++i) {
+        read_awaiter read{ s, loop };
+        co_await read;
+        s->bytes += 1;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// owned_task: s is the one owner, the callbacks borrow it
+
+SessionTask owned_serve(SessionPtr s, event_loop &loop, int reads)
+{
+    for (int i = 0; i < reads; ++i) {
+        co_await await_callback([&loop](SessionTask::resumer resume) {
+            SessionRef session(resume.owner());
+            loop.post([session, resume]() { session->bytes += 1; resume(); });
+        });
+        s->bytes += 1;
+    }
+}
+
+struct Guard
+{
+    ~Guard() { ++Guards_destroyed; }
+};
+
+// waits without keeping the session alive
+SessionTask watcher(SessionPtr s, event_loop &loop, int &stage)
+{
+    Guard g;
+    stage = 1;
+    co_await await_callback_weak([&loop](SessionTask::weak_resumer resume) { loop.post(resume); });
+    stage = 2;
+    s->bytes += 100;
+}
+
+void test_coro(void)
+{
+    event_loop loop;
+    {
+        SessionPtr s(new Session());
+        long ops = Count_ops;
+        owned_serve(s, loop, 10);
+        ASSERT( s.use_count() == 2 && loop.queue.size() == 1 );
+        loop.run();
+        ASSERT( s->bytes == 20 && s.unique() );
+        ASSERT( Count_ops - ops == 2 );             // into the parameter and out, nothing per read
+
+        ops = Count_ops;
+        plain_serve(s, loop, 10);
+        loop.run();
+        ASSERT( s->bytes == 40 && s.unique() );
+        ASSERT( Count_ops - ops > 20 );
+    }
+    ASSERT( Sessions_live == 0 );
+
+    // a weak wait: the task lets go of the session and takes it back
+    {
+        SessionPtr keep(new Session());
+        int stage = 0;
+        watcher(keep, loop, stage);
+        ASSERT( stage == 1 && keep.unique() );
+        loop.run();
+        ASSERT( stage == 2 && keep->bytes == 100 && keep.unique() && Guards_destroyed == 1 );
+    }
+    ASSERT( Sessions_live == 0 );
+
+    // the last other owner goes while the task waits: it is destroyed, not resumed
+    {
+        int stage = 0;
+        watcher(SessionPtr(new Session()), loop, stage);
+        ASSERT( stage == 1 && Sessions_live == 0 && Guards_destroyed == 1 );
+        loop.run();
+        ASSERT( stage == 1 && Guards_destroyed == 2 );
+    }
+
+    // the session dropped by its owner elsewhere during the wait
+    {
+        SessionPtr keep(new Session());
+        int stage = 0;
+        watcher(keep, loop, stage);
+        keep.reset();
+        ASSERT( Sessions_live == 0 );
+        loop.run();
+        ASSERT( stage == 1 && Guards_destroyed == 3 );
+    }
+
+    std::cout << "owned_task OK" << std::endl;
+}
+
+
+template <typename task_fn>
+void bench(const char *name, task_fn serve, int sessions, int reads)
+{
+    event_loop loop;
+    std::deque<SessionPtr> all;
+    for (int i = 0; i < sessions; ++i) {
+        all.push_back(SessionPtr(new Session()));
+    }
+    Measuring = true;
+    serve(all[0], loop, 0);
+    size_t frame = Frame_size;
+
+    long ops = Count_ops;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < sessions; ++i) {
+        serve(all[i], loop, reads);
+    }
+    loop.run();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    double suspensions = (double)sessions * reads;
+    printf("%-28s frame %3zu bytes  %5.2f count updates/suspension  %6.2f ns/suspension\n",
+        name, frame, (Count_ops - ops) / suspensions, ns / suspensions);
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_coro();
+
+    printf("strong_ptr %zu bytes, strong_ref %zu bytes, resumer %zu bytes\n",
+        sizeof(SessionPtr), sizeof(SessionRef), sizeof(SessionTask::resumer));
+    bench("copying awaiters", &plain_serve, 1000, 1000);
+    bench("owned_task, borrowed", &owned_serve, 1000, 1000);
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <stdio.h>
+#include <assert.h>
+#include "intern_ptr.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+typedef intern_table<std::string> StringTable;
+typedef StringTable::pointer_type StringPtr;
+
+struct Config
+{
+    Config(int _level, const std::string &_name) : level(_level), name(_name) {}
+    bool operator==(const Config &rhs) const { return level == rhs.level && name == rhs.name; }
+    int level;
+    std::string name;
+};
+
+struct ConfigHash
+{
+    size_t operator()(const Config &c) const
+    { return std::hash<std::string>()(c.name) * 31 + (size_t)c.level; }
+};
+
+void test_intern(void)
+{
+    StringTable table;
+
+    StringPtr a = table.generate("alpha");
+    StringPtr b = table.generate(std::string("alp") + "ha");
+    StringPtr c = table.generate("beta");
+    ASSERT( a.get() == b.get() );
+    ASSERT( a.get() != c.get() );
+    ASSERT( a.use_count() == 2 );
+
+    StringTable::statistics st = table.get_statistics();
+    ASSERT( st.hits == 1 && st.misses == 2 && st.entries == 2 );
+
+    // the table does not keep values alive
+    weak_ptr<std::string, std_mem_mgr<std::string>, mt_ref_count> wa(a);
+    a.reset();
+    b.reset();
+    ASSERT( wa.expired() );
+    ASSERT( table.purge() == 1 );
+    ASSERT( table.get_statistics().entries == 1 );
+
+    // a new lookup after the last owner left allocates a fresh object
+    StringPtr d = table.generate("alpha");
+    ASSERT( *d == "alpha" );
+    ASSERT( d.use_count() == 1 );
+
+    intern_table<Config, std_mem_mgr<Config>, mt_ref_count, ConfigHash> configs;
+    strong_ptr<Config, std_mem_mgr<Config>, mt_ref_count> c1 = configs.generate(3, "default");
+    strong_ptr<Config, std_mem_mgr<Config>, mt_ref_count> c2 = configs.generate(3, "default");
+    strong_ptr<Config, std_mem_mgr<Config>, mt_ref_count> c3 = configs.generate(4, "default");
+    ASSERT( c1.get() == c2.get() );
+    ASSERT( c1.get() != c3.get() );
+
+    StringPtr g1 = make_interned_ptr<std::string>::generate("global");
+    StringPtr g2 = make_interned_ptr<std::string>::generate("global");
+    ASSERT( g1.get() == g2.get() );
+
+    std::cout << "intern OK" << std::endl;
+}
+
+// Every thread interns keys from a small vocabulary and keeps a window of
+// the results alive, the way a parser keeps recently seen identifiers.
+void bench_intern(int thread_count, int vocabulary, int lookups)
+{
+    StringTable table(64);
+    std::vector<std::string> words;
+    for (int i = 0; i < vocabulary; ++i) {
+        char buf[64];
+        sprintf(buf, "config.section%d.key%d", i % 97, i);
+        words.push_back(buf);
+    }
+
+    std::vector<std::thread> threads;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int t = 0; t < thread_count; ++t) {
+        threads.push_back(std::thread([&table, &words, lookups, t]() {
+            std::vector<StringPtr> window(4096);
+            unsigned int seed = 2166136261u + t;
+            for (int i = 0; i < lookups; ++i) {
+                seed = seed * 1103515245u + 12345u;
+                // skewed pick, low indices are hot
+                size_t r = (seed >> 8) % words.size();
+                size_t idx = (r * r) / words.size();
+                window[i & 4095] = table.intern(words[idx]);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    StringTable::statistics st = table.get_statistics();
+    printf("threads=%2d lookups=%d  dedupe ratio=%.3f  objects allocated=%lu  %.1f ns/lookup\n",
+        thread_count, thread_count * lookups, st.dedupe_ratio(),
+        (unsigned long)st.misses, ns / lookups);
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_intern();
+
+    unsigned int cores = std::thread::hardware_concurrency();
+    unsigned int max_threads = (cores > 4) ? cores : 4;
+    for (unsigned int n = 1; n <= max_threads; n *= 2) {
+        bench_intern((int)n, 2000, 200000);
+    }
+    return 0;
+}
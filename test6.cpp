@@ -0,0 +1,186 @@
+#include <iostream>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <stdio.h>
+#include <assert.h>
+#include "lockfree_queue.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+namespace {
+    std::atomic<int> Message_live_count(0);
+}
+
+struct Message
+{
+    explicit Message(long _seq) : seq(_seq) { ++Message_live_count; }
+    ~Message() { --Message_live_count; }
+    long seq;
+};
+
+typedef strong_ptr<Message, std_mem_mgr<Message>, mt_ref_count> MessagePtr;
+
+void test_containers(void)
+{
+    strong_ptr_queue<Message> queue(4);
+    ASSERT( queue.capacity() == 4 );
+
+    MessagePtr m1(new Message(1));
+    MessagePtr keep(m1);
+    ASSERT( queue.try_push(std::move(m1)) );
+    ASSERT( m1.get() == 0 );
+    ASSERT( keep.use_count() == 2 );   // no count traffic while queued
+
+    for (long i = 2; i <= 4; ++i) {
+        ASSERT( queue.try_push(MessagePtr(new Message(i))) );
+    }
+    MessagePtr extra(new Message(5));
+    ASSERT( !queue.try_push(std::move(extra)) );
+    ASSERT( extra.get() != 0 );        // a failed push leaves the pointer alone
+
+    MessagePtr out;
+    for (long i = 1; i <= 4; ++i) {
+        ASSERT( queue.try_pop(out) );
+        ASSERT( out->seq == i );
+    }
+    ASSERT( !queue.try_pop(out) );
+    ASSERT( keep.use_count() == 1 );
+
+    strong_ptr_stack<Message> stack(2);
+    ASSERT( stack.try_push(std::move(keep)) );
+    ASSERT( stack.try_push(std::move(extra)) );
+    ASSERT( !stack.try_push(MessagePtr(new Message(6))) );
+    ASSERT( stack.try_pop(out) && out->seq == 5 );
+    ASSERT( stack.try_pop(out) && out->seq == 1 );
+    ASSERT( !stack.try_pop(out) );
+    out.reset();
+
+    {
+        // elements still inside are released with the container
+        strong_ptr_queue<Message> q2(8);
+        strong_ptr_stack<Message> s2(8);
+        q2.try_push(MessagePtr(new Message(7)));
+        s2.try_push(MessagePtr(new Message(8)));
+    }
+    ASSERT( Message_live_count == 0 );
+
+    std::cout << "lock-free containers OK" << std::endl;
+}
+
+
+// the setup the containers replace
+class locked_deque
+{
+public:
+    bool try_push(const MessagePtr &p)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_items.push_back(p);
+        return true;
+    }
+
+    bool try_pop(MessagePtr &p)
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (m_items.empty()) {
+            return false;
+        }
+        p = m_items.front();
+        m_items.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex m_lock;
+    std::deque<MessagePtr> m_items;
+};
+
+template <typename container>
+bool push_message(container &c, MessagePtr &p) { return c.try_push(std::move(p)); }
+
+bool push_message(locked_deque &c, MessagePtr &p) { return c.try_push(p); }
+
+template <typename container>
+double run_pipeline(container &c, int producers, int consumers, long per_producer)
+{
+    std::atomic<long> consumed(0);
+    std::atomic<long> checksum(0);
+    long total = per_producer * producers;
+    std::vector<std::thread> threads;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < producers; ++i) {
+        threads.push_back(std::thread([&c, per_producer]() {
+            for (long n = 0; n < per_producer; ++n) {
+                MessagePtr p(new Message(n));
+                while (!push_message(c, p)) {
+                    std::this_thread::yield();
+                }
+            }
+        }));
+    }
+    for (int i = 0; i < consumers; ++i) {
+        threads.push_back(std::thread([&c, &consumed, &checksum, total]() {
+            MessagePtr p;
+            long sum = 0;
+            while (consumed.load(std::memory_order_relaxed) < total) {
+                if (c.try_pop(p)) {
+                    sum += p->seq;
+                    p.reset();
+                    consumed.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            checksum += sum;
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    ASSERT( consumed == total );
+    ASSERT( checksum == (long)producers * per_producer * (per_producer - 1) / 2 );
+    ASSERT( Message_live_count == 0 );
+    return total / seconds / 1e6;
+}
+
+void bench_pipeline(int producers, int consumers, long per_producer)
+{
+    strong_ptr_queue<Message> queue(4096);
+    strong_ptr_stack<Message> stack(4096);
+    locked_deque locked;
+
+    double q = run_pipeline(queue, producers, consumers, per_producer);
+    double s = run_pipeline(stack, producers, consumers, per_producer);
+    double l = run_pipeline(locked, producers, consumers, per_producer);
+    printf("%dP/%dC  queue %6.2f  stack %6.2f  mutex+deque %6.2f  Mmsg/s\n",
+        producers, consumers, q, s, l);
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_containers();
+
+    static const int mixes[][2] = { {1, 1}, {1, 4}, {4, 1}, {2, 2}, {4, 4}, {8, 8} };
+    for (size_t i = 0; i < sizeof(mixes) / sizeof(mixes[0]); ++i) {
+        bench_pipeline(mixes[i][0], mixes[i][1], 200000 / mixes[i][0]);
+    }
+    return 0;
+}
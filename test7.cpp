@@ -0,0 +1,161 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <assert.h>
+#include "cycle_collector.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+namespace {
+    std::atomic<int> Node_live_count(0);
+}
+
+struct Node;
+typedef strong_ptr<Node, std_mem_mgr<Node>, mt_ref_count> NodePtr;
+typedef weak_ptr<Node, std_mem_mgr<Node>, mt_ref_count> NodeWeakPtr;
+
+struct Node
+{
+    explicit Node(int _id) : id(_id) { ++Node_live_count; }
+    ~Node() { --Node_live_count; }
+    int id;
+    NodePtr next;
+    NodePtr other;
+    char payload[48];
+};
+
+namespace smart_ptr {
+template <> struct cycle_edges<Node>
+{
+    template <class V> static void visit(Node &n, V &v) { v(n.next); v(n.other); }
+};
+}
+
+typedef make_collectable_ptr<Node> NodeFactory;
+typedef cycle_collector<> Collector;
+
+// a ring of n nodes, every third one also pointing back two steps
+NodePtr make_ring(int n)
+{
+    std::vector<NodePtr> nodes;
+    for (int i = 0; i < n; ++i) {
+        nodes.push_back(NodeFactory::generate(i));
+    }
+    for (int i = 0; i < n; ++i) {
+        nodes[i]->next = nodes[(i + 1) % n];
+        if (i % 3 == 0) {
+            nodes[i]->other = nodes[(i + n - 2) % n];
+        }
+    }
+    return nodes[0];
+}
+
+void test_collector(void)
+{
+    Collector &gc = Collector::instance();
+
+    NodePtr kept = make_ring(10);
+    NodeWeakPtr leaked;
+    {
+        NodePtr ring = make_ring(10);
+        leaked = ring;
+        NodePtr self = NodeFactory::generate(100);
+        self->next = self;
+    }
+    ASSERT( Node_live_count == 21 );
+    ASSERT( !leaked.expired() );
+
+    size_t reclaimed = gc.collect();
+    ASSERT( reclaimed == 11 );
+    ASSERT( leaked.expired() );
+    ASSERT( Node_live_count == 10 );
+    ASSERT( kept->next->next->id == 2 );
+
+    // a slice smaller than the cycle can not prove it dead, but stays safe
+    kept.reset();
+    ASSERT( gc.collect(4) == 0 );
+    ASSERT( Node_live_count == 10 );
+    ASSERT( gc.collect() == 10 );
+    ASSERT( Node_live_count == 0 );
+
+    Collector::statistics st = gc.get_statistics();
+    ASSERT( st.reclaimed_objects == 21 );
+    ASSERT( st.reclaimed_bytes == 21 * (sizeof(Node) + sizeof(mt_ref_count)) );
+    ASSERT( st.tracked == 0 );
+
+    // a cycle holding two immortal objects: they are not tracked, the cycle still goes
+    {
+        static Node first(200), second(201);
+        NodePtr a(immortal_tag(), &first), b(immortal_tag(), &second);
+        gc.track(a);
+        gc.track(b);
+        ASSERT( gc.get_statistics().tracked == 0 );
+        int live = Node_live_count;
+        NodePtr x = NodeFactory::generate(1), y = NodeFactory::generate(2);
+        x->next = y;
+        y->next = x;
+        x->other = a;
+        y->other = b;
+        x.reset();
+        y.reset();
+        ASSERT( gc.collect() == 2 && Node_live_count == live );
+        ASSERT( first.id == 200 && second.id == 201 && !first.next && !second.next );
+    }
+
+    std::cout << "cycle collector OK" << std::endl;
+}
+
+// mutators build and drop rings while the collector runs in the background
+void bench_collector(int threads, int rings_per_thread, int ring_size)
+{
+    Collector &gc = Collector::instance();
+    Collector::statistics before = gc.get_statistics();
+    int live = Node_live_count;
+    gc.start(std::chrono::milliseconds(1), 1024);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.push_back(std::thread([&gc, rings_per_thread, ring_size]() {
+            for (int i = 0; i < rings_per_thread; ++i) {
+                Collector::mutator_lock lock = gc.lock_mutator();
+                NodePtr ring = make_ring(ring_size);
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+    gc.stop();
+    gc.collect();
+    ASSERT( Node_live_count == live );
+
+    Collector::statistics st = gc.get_statistics();
+    size_t steps = st.steps - before.steps;
+    printf("threads=%d rings=%d  reclaimed %lu objects / %lu bytes in %lu steps  pause avg %.3f ms max %.3f ms\n",
+        threads, threads * rings_per_thread,
+        (unsigned long)(st.reclaimed_objects - before.reclaimed_objects),
+        (unsigned long)(st.reclaimed_bytes - before.reclaimed_bytes),
+        (unsigned long)steps, (st.total_pause_ms - before.total_pause_ms) / (steps ? steps : 1),
+        st.max_pause_ms);
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_collector();
+    bench_collector(1, 2000, 16);
+    bench_collector(4, 2000, 16);
+    return 0;
+}
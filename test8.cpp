@@ -0,0 +1,207 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define ASSERT assert
+
+#if defined(__linux__)
+
+#include <signal.h>
+#include <sys/wait.h>
+#include "shm_ptr.h"
+
+using namespace smart_ptr;
+
+struct Stats
+{
+    Stats() : destroyed(0) {}
+    int destroyed;
+};
+
+// a read-only table shared in place, no pointers except shm_offset_ptr
+struct Table
+{
+    explicit Table(shm_offset_ptr<Stats> _stats) : stats(_stats), count(4096)
+    {
+        for (int i = 0; i < count; ++i) {
+            values[i] = i * 3;
+        }
+        largest = &values[count - 1];
+    }
+    ~Table()
+    {
+        __atomic_add_fetch(&stats->destroyed, 1, __ATOMIC_RELAXED);
+    }
+
+    long sum() const
+    {
+        long s = 0;
+        for (int i = 0; i < count; ++i) {
+            s += values[i];
+        }
+        return s;
+    }
+
+    shm_offset_ptr<Stats> stats;
+    shm_offset_ptr<long> largest;
+    int count;
+    long values[4096];
+};
+
+void test_allocator(shm_segment &seg)
+{
+    size_t base = seg.bytes_in_use();
+    void *a = seg.allocate(100);
+    void *b = seg.allocate(1000);
+    void *c = seg.allocate(10);
+    ASSERT( a && b && c );
+    seg.deallocate(b);
+    seg.deallocate(a);
+    seg.deallocate(c);
+    ASSERT( seg.bytes_in_use() == base );
+    // everything merged back, a big block fits again
+    void *d = seg.allocate(512 * 1024);
+    ASSERT( d );
+    seg.deallocate(d);
+}
+
+// children killed while they allocate, often inside the segment lock
+void test_owner_died(shm_segment &seg)
+{
+    for (int round = 0; round < 20; ++round) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            void *held[8] = { 0 };
+            for (unsigned i = 0; ; ++i) {
+                seg.deallocate(held[i % 8]);
+                held[i % 8] = seg.allocate(16 + (i * 37) % 2000);
+            }
+        }
+        usleep(2000);
+        kill(pid, SIGKILL);
+        waitpid(pid, 0, 0);
+
+        // either the heap checked out and is still usable, or it says so
+        if (seg.damaged()) {
+            ASSERT( !seg.allocate(16) );
+            return;
+        }
+        void *p = seg.allocate(100);
+        ASSERT( p && seg.contains(p) );
+        seg.deallocate(p);
+    }
+}
+
+int run_child(const char *name, shm_handle handle, int child, const void *parent_address)
+{
+    // keep the old address busy so the segment maps somewhere else
+    void *hole = mmap(0, 1 << 20, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    shm_segment seg;
+    if (!seg.open(name)) {
+        return 2;
+    }
+
+    shm_strong_ptr<Table> table;
+    seg.adopt(handle, table);
+    shm_strong_ptr<Table> named;
+    bool found = seg.lookup("table", named);
+
+    long expected = 3L * 4096 * 4095 / 2;
+    int rc = 0;
+    if (table->sum() != expected || *table->largest != 3L * 4095) {
+        rc = 3;
+    }
+    if (found && named.get() != table.get()) {
+        rc = 4;
+    }
+    if (table.get() == parent_address) {
+        rc = 5;     // same address, the offsets were not put to the test
+    }
+    usleep(1000 * (child % 3));
+    named.reset();
+    table.reset();
+    seg.close();
+    munmap(hole, 1 << 20);
+    return rc;
+}
+
+void test_processes(void)
+{
+    char name[64];
+    sprintf(name, "/smart_ptr_test8_%d", (int)getpid());
+    shm_segment::remove(name);
+
+    shm_segment seg;
+    ASSERT( seg.create(name, 1 << 20) );
+    test_allocator(seg);
+
+    size_t base = seg.bytes_in_use();
+    shm_strong_ptr<Stats> stats = make_shm_ptr<Stats>::generate(seg);
+    size_t with_stats = seg.bytes_in_use();
+    shm_strong_ptr<Table> table = make_shm_ptr<Table>::generate(seg, shm_offset_ptr<Stats>(stats.get()));
+    ASSERT( table.get() && seg.contains(table.get()) );
+    ASSERT( seg.publish("table", table) );
+    ASSERT( !seg.publish("table", table) );
+    ASSERT( table.use_count() == 2 );
+
+    // one reference per child travels in its handle
+    const int children = 4;
+    shm_handle handles[children];
+    for (int i = 0; i < children; ++i) {
+        handles[i] = seg.share(table);
+    }
+    ASSERT( table.use_count() == 2 + children );
+
+    const void *address = table.get();
+    pid_t pids[children];
+    for (int i = 0; i < children; ++i) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            _exit(run_child(name, handles[i], i, address));
+        }
+    }
+
+    // the parent leaves first, the children keep the table alive
+    table.reset();
+    shm_strong_ptr<Table> dropped;
+    ASSERT( seg.unpublish("table", dropped) );
+
+    for (int i = 0; i < children; ++i) {
+        int status = 0;
+        waitpid(pids[i], &status, 0);
+        ASSERT( WIFEXITED(status) && WEXITSTATUS(status) == 0 );
+    }
+
+    // the last child freed object and counter block in the segment
+    ASSERT( stats->destroyed == 1 );
+    ASSERT( seg.bytes_in_use() == with_stats );
+    stats.reset();
+    ASSERT( seg.bytes_in_use() == base );
+
+    test_owner_died(seg);
+
+    seg.close();
+    shm_segment::remove(name);
+    std::cout << "shared memory OK" << std::endl;
+}
+
+#else
+
+void test_processes(void) {}
+
+#endif // defined(__linux__)
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_processes();
+    return 0;
+}
@@ -0,0 +1,296 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "graph_snapshot.h"
+
+#define ASSERT assert
+
+using namespace smart_ptr;
+
+struct Label
+{
+    explicit Label(const char *_name) { snprintf(name, sizeof(name), "%s", _name); }
+    char name[32];
+};
+
+struct Node
+{
+    explicit Node(int _value) : value(_value) {}
+    int value;
+    strong_ptr<Node> left;
+    strong_ptr<Node> right;
+    strong_ptr<Label> label;
+};
+
+typedef strong_ptr<Node> NodePtr;
+typedef strong_ptr<Label> LabelPtr;
+
+// the flat records as they sit in the file
+struct FlatLabel
+{
+    char name[32];
+};
+
+struct FlatNode
+{
+    int value;
+    snapshot_ref<FlatNode> left;
+    snapshot_ref<FlatNode> right;
+    snapshot_ref<FlatLabel> label;
+};
+
+namespace smart_ptr {
+template <> struct snapshot_traits<Label>
+{
+    typedef FlatLabel flat_type;
+    static void write(const Label &l, FlatLabel &f, snapshot_writer &)
+    { memcpy(f.name, l.name, sizeof(f.name)); }
+};
+
+template <> struct snapshot_traits<Node>
+{
+    typedef FlatNode flat_type;
+    static void write(const Node &n, FlatNode &f, snapshot_writer &w)
+    {
+        f.value = n.value;
+        w.link(f.left, n.left);
+        w.link(f.right, n.right);
+        w.link(f.label, n.label);
+    }
+};
+}
+
+bool write_image(const char *path, const std::vector<char> &image)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        return false;
+    }
+    bool ok = fwrite(&image[0], 1, image.size(), fp) == image.size();
+    return (fclose(fp) == 0) && ok;
+}
+
+void test_snapshot(void)
+{
+    // a diamond sharing one node and one label, plus a cycle back to the root
+    NodePtr root(new Node(1));
+    NodePtr shared(new Node(4));
+    LabelPtr label(new Label("shared"));
+    root->left.reset(new Node(2));
+    root->right.reset(new Node(3));
+    root->left->left = shared;
+    root->right->left = shared;
+    root->left->label = label;
+    shared->label = label;
+    shared->right = root;
+
+    snapshot_writer writer;
+    ASSERT( writer.save("test9.snapshot", root) );
+    ASSERT( writer.object_count() == 5 );
+    shared->right.reset();
+
+    snapshot_file<> snap;
+    ASSERT( snap.open("test9.snapshot") );
+    ASSERT( snap.object_count() == 5 );
+    ASSERT( !snap.root<FlatLabel>() );
+
+    strong_ptr<const FlatNode, snapshot_mem_mgr<const FlatNode> > r = snap.root<FlatNode>();
+    ASSERT( r->value == 1 && r->left->value == 2 && r->right->value == 3 );
+    ASSERT( r->left->left.get() == r->right->left.get() );      // written once
+    ASSERT( r->left->label.get() == r->left->left->label.get() );
+    ASSERT( strcmp(r->left->left->label->name, "shared") == 0 );
+    ASSERT( r->left->left->right.get() == r.get() );            // the cycle survives
+    ASSERT( r->right->label.get() == 0 );
+
+    strong_ptr<const FlatNode, snapshot_mem_mgr<const FlatNode> > s = snap.share(r->left->left.get());
+    ASSERT( s->value == 4 );
+    ASSERT( s.use_count() == 3 );   // the file, r and s share one counter
+    r.reset();
+    s.reset();
+    snap.close();
+    ASSERT( snapshot_mappings::count() == 0 );
+
+    // a record kept past close() keeps the mapping, the last one releases it
+    ASSERT( snap.open("test9.snapshot") );
+    r = snap.root<FlatNode>();
+    snap.close();
+    ASSERT( snapshot_mappings::count() == 1 && r->left->value == 2 );
+    r.reset();
+    ASSERT( snapshot_mappings::count() == 0 );
+
+    // a root record running past the end and a link out of the file are refused
+    std::vector<char> image = writer.build(root);
+    snapshot_writer::file_header *h = (snapshot_writer::file_header *)&image[0];
+    size_t root_offset = (size_t)h->root_offset;
+    h->root_offset = (image.size() - 8) & ~(size_t)7;
+    ASSERT( write_image("test9.snapshot", image) && snap.open("test9.snapshot") );
+    ASSERT( !snap.root<FlatNode>() );
+    snap.close();
+
+    h->root_offset = root_offset;
+    long long *link = (long long *)&image[root_offset + offsetof(FlatNode, left)];
+    *link = (long long)image.size();
+    ASSERT( write_image("test9.snapshot", image) && snap.open("test9.snapshot") );
+    r = snap.root<FlatNode>();
+    ASSERT( r && !snap.share(r->left) && snap.share(r->right)->value == 3 );
+    r.reset();
+    snap.close();
+    ASSERT( snapshot_mappings::count() == 0 );
+
+    // immortal pointers share one counter block, the objects are still two records
+    static Node first(7), second(8);
+    NodePtr top(new Node(6));
+    top->left = NodePtr(immortal_tag(), &first);
+    top->right = NodePtr(immortal_tag(), &second);
+    ASSERT( top->left.get_counter() == top->right.get_counter() );
+    ASSERT( writer.save("test9.snapshot", top) && writer.object_count() == 3 );
+    ASSERT( snap.open("test9.snapshot") );
+    r = snap.root<FlatNode>();
+    ASSERT( r->value == 6 && r->left->value == 7 && r->right->value == 8 );
+    r.reset();
+    snap.close();
+    remove("test9.snapshot");
+
+    std::cout << "snapshot OK" << std::endl;
+}
+
+
+// the baseline: every path writes its own copy, loading rebuilds node by node
+void naive_write(FILE *fp, const NodePtr &n)
+{
+    char present = n.get() ? 1 : 0;
+    fwrite(&present, 1, 1, fp);
+    if (!present) {
+        return;
+    }
+    fwrite(&n->value, sizeof(n->value), 1, fp);
+    char has_label = n->label.get() ? 1 : 0;
+    fwrite(&has_label, 1, 1, fp);
+    if (has_label) {
+        fwrite(n->label->name, sizeof(n->label->name), 1, fp);
+    }
+    naive_write(fp, n->left);
+    naive_write(fp, n->right);
+}
+
+NodePtr naive_read(FILE *fp)
+{
+    char present = 0;
+    if (fread(&present, 1, 1, fp) != 1 || !present) {
+        return NodePtr();
+    }
+    int value = 0;
+    fread(&value, sizeof(value), 1, fp);
+    NodePtr n = make_strong_ptr<Node>::generate(value);
+    char has_label = 0;
+    fread(&has_label, 1, 1, fp);
+    if (has_label) {
+        char name[32];
+        fread(name, sizeof(name), 1, fp);
+        n->label = make_strong_ptr<Label>::generate((const char *)name);
+    }
+    n->left = naive_read(fp);
+    n->right = naive_read(fp);
+    return n;
+}
+
+long sum_heap(const NodePtr &n)
+{
+    return n.get() ? n->value + sum_heap(n->left) + sum_heap(n->right) : 0;
+}
+
+long sum_flat(const FlatNode *n)
+{
+    return n ? n->value + sum_flat(n->left.get()) + sum_flat(n->right.get()) : 0;
+}
+
+long file_size(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    fseek(fp, 0, SEEK_END);
+    long n = ftell(fp);
+    fclose(fp);
+    return n;
+}
+
+double ms_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// a complete binary tree of n nodes sharing a small pool of labels
+void bench_snapshot(int n, int labels)
+{
+    std::vector<LabelPtr> pool;
+    for (int i = 0; i < labels; ++i) {
+        char name[32];
+        sprintf(name, "label-%d", i);
+        pool.push_back(LabelPtr(new Label(name)));
+    }
+    std::vector<NodePtr> nodes;
+    for (int i = 0; i < n; ++i) {
+        nodes.push_back(NodePtr(new Node(i)));
+        nodes[i]->label = pool[i % labels];
+    }
+    for (int i = 0; i < n; ++i) {
+        if (2 * i + 1 < n) nodes[i]->left = nodes[2 * i + 1];
+        if (2 * i + 2 < n) nodes[i]->right = nodes[2 * i + 2];
+    }
+    NodePtr root = nodes[0];
+    nodes.clear();
+    long expected = sum_heap(root);
+
+    std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+    snapshot_writer writer;
+    writer.save("test9_bench.snapshot", root);
+    double save_ms = ms_since(t);
+
+    t = std::chrono::steady_clock::now();
+    FILE *fp = fopen("test9_bench.naive", "wb");
+    naive_write(fp, root);
+    fclose(fp);
+    double naive_save_ms = ms_since(t);
+
+    t = std::chrono::steady_clock::now();
+    snapshot_file<> snap;
+    snap.open("test9_bench.snapshot");
+    strong_ptr<const FlatNode, snapshot_mem_mgr<const FlatNode> > mapped = snap.root<FlatNode>();
+    double load_ms = ms_since(t);
+    ASSERT( sum_flat(mapped.get()) == expected );
+
+    t = std::chrono::steady_clock::now();
+    fp = fopen("test9_bench.naive", "rb");
+    NodePtr rebuilt = naive_read(fp);
+    fclose(fp);
+    double naive_load_ms = ms_since(t);
+    ASSERT( sum_heap(rebuilt) == expected );
+
+    printf("nodes=%d labels=%d\n", n, labels);
+    printf("  snapshot  %9ld bytes  save %8.2f ms  load %8.3f ms\n", file_size("test9_bench.snapshot"), save_ms, load_ms);
+    printf("  naive     %9ld bytes  save %8.2f ms  load %8.3f ms\n", file_size("test9_bench.naive"), naive_save_ms, naive_load_ms);
+
+    mapped.reset();
+    snap.close();
+    remove("test9_bench.snapshot");
+    remove("test9_bench.naive");
+}
+
+#ifndef CDECL
+#if defined(WIN32)
+#define CDECL           _cdecl
+#else
+#define CDECL
+#endif // defined(WIN32)
+#endif // !CDECL
+
+int CDECL main()
+{
+    test_snapshot();
+    bench_snapshot(100000, 64);
+    bench_snapshot(1000000, 64);
+    return 0;
+}